@@ -0,0 +1,57 @@
+#!/bin/sh
+# Measures how long collecting registered tests takes at startup.
+#
+# usage: bench/startup.sh [TESTS] [TRANSLATION_UNITS]
+#
+# Generates TESTS trivial tests spread over TRANSLATION_UNITS files with 100 modules each, then
+# prints how long `su_state_init` took and the wall time of the whole process.  `stb_ds.h` must be
+# in the include path (set CFLAGS to add it).
+set -e
+
+tests=${1:-1000000}
+units=${2:-16}
+root=$(cd "$(dirname "$0")/.." && pwd)
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+per_unit=$(( (tests + units - 1) / units ))
+i=0
+while [ "$i" -lt "$units" ]; do
+    awk -v unit="$i" -v count="$per_unit" 'BEGIN {
+        print "#include \"smallunit.h\""
+        for (j = 0; j < count; ++j) {
+            printf "su_test(mod%d_%d, t%d) { (void)su_self; }\n", unit, j * 100 / count, j
+        }
+    }' > "$dir/unit$i.c"
+    i=$((i + 1))
+done
+
+cat > "$dir/main.c" <<'MAIN'
+#define SU_IMPLEMENTATION
+#define STB_DS_IMPLEMENTATION
+#include "smallunit.h"
+
+int
+main(void) {
+    // registration runs no code before main, collecting the tests is all the startup work
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    su_state_init(&su__state);
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("%zu tests in %zu modules collected in %.2fms\n",
+           su__state.test_count, su__state.module_count, ms);
+    return 0;
+}
+MAIN
+
+for f in "$dir"/*.c; do
+    ${CC:-cc} -O2 -D_GNU_SOURCE -c -I"$root" $CFLAGS "$f" -o "${f%.c}.o" &
+done
+wait
+${CC:-cc} "$dir"/*.o -o "$dir/startup" -lm -lpthread
+start=$(date +%s%N)
+"$dir/startup"
+end=$(date +%s%N)
+echo "process wall time: $(( (end - start) / 1000000 ))ms"
@@ -1,24 +1,90 @@
 // https://github.com/JaMo42/smallunit
 #ifndef SMALLUNIT_H
 #define SMALLUNIT_H
+// the implementation uses GNU and Linux extensions (`memfd_create`, `dladdr`, `sched_getcpu`, ...)
+#if defined(SU_IMPLEMENTATION) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#if defined(SU_IMPLEMENTATION) && defined(__GLIBC__) && !defined(__USE_GNU)
+#error "include smallunit.h with SU_IMPLEMENTATION before any system header, or define _GNU_SOURCE"
+#endif
+
 #include "stb_ds.h"
 
 #ifndef SU_FIXTURE_IDENTIFIER
 #define SU_FIXTURE_IDENTIFIER self
 #endif
 
+/// Initial capacity of the buffers capturing the output of death tests, they grow as needed.
 #ifndef SU_STDERR_BUF_SIZE
 #define SU_STDERR_BUF_SIZE 4096
 #endif
 
+/// Maximum number of children of a `su_subproc_batch_t` running at the same time.
+#ifndef SU_MAX_ASYNC_SUBPROCS
+#define SU_MAX_ASYNC_SUBPROCS 32
+#endif
+
+/// Size of the buffer of the `--report-file`.
+#ifndef SU_REPORT_BUF_SIZE
+#define SU_REPORT_BUF_SIZE (1 << 20)
+#endif
+
+/// Maximum number of bytes of output captured per test with `--capture`, the rest is dropped.
+#ifndef SU_CAPTURE_LIMIT
+#define SU_CAPTURE_LIMIT (1 << 20)
+#endif
+
+#ifndef SU_BENCH_SAMPLES
+#define SU_BENCH_SAMPLES 10
+#endif
+
+/// Maximum number of input sizes of a `su_bench_range`.
+#ifndef SU_BENCH_RANGE_POINTS
+#define SU_BENCH_RANGE_POINTS 16
+#endif
+
+/// Maximum number of `su_bench_counter`s per benchmark.
+#ifndef SU_BENCH_COUNTERS
+#define SU_BENCH_COUNTERS 8
+#endif
+
+/// Each power of two of a `su_histogram_t` is split into `2^SU_HISTOGRAM_SUB_BITS` buckets.
+#ifndef SU_HISTOGRAM_SUB_BITS
+#define SU_HISTOGRAM_SUB_BITS 5
+#endif
+
+#ifndef SU_FAILURE_VALUES
+#define SU_FAILURE_VALUES 3
+#endif
+
+#ifndef SU_BASELINE_ALPHA
+#define SU_BASELINE_ALPHA 0.01
+#endif
+
+/// Samples per second of CPU time taken with `--profile`.
+#ifndef SU_PROFILE_HZ
+#define SU_PROFILE_HZ 997
+#endif
+
+/// Maximum number of samples per test and frames per sample kept with `--profile`.
+#ifndef SU_PROFILE_SAMPLES
+#define SU_PROFILE_SAMPLES 16384
+#endif
+
+#ifndef SU_PROFILE_DEPTH
+#define SU_PROFILE_DEPTH 64
+#endif
+
 #if __has_include(<valgrind/valgrind.h>)
 #include <valgrind/valgrind.h>
 #define SU_HAS_VALGRIND
@@ -47,6 +113,11 @@
 #define EXPECT_FLOAT_EQ su_expect_float_eq
 #define EXPECT_DOUBLE_EQ su_expect_double_eq
 #define EXPECT_NEAR su_expect_near
+#define EXPECT_MEM_EQ su_expect_mem_eq
+#define EXPECT_ARRAY_EQ su_expect_array_eq
+#define EXPECT_FLOAT_ARRAY_EQ su_expect_float_array_eq
+#define EXPECT_DOUBLE_ARRAY_EQ su_expect_double_array_eq
+#define EXPECT_ARRAY_NEAR su_expect_array_near
 
 #define ASSERT su_assert
 #define ASSERT_EQ su_assert_eq
@@ -56,9 +127,22 @@
 #define ASSERT_FLOAT_EQ su_assert_float_eq
 #define ASSERT_DOUBLE_EQ su_assert_double_eq
 #define ASSERT_NEAR su_assert_near
+#define ASSERT_MEM_EQ su_assert_mem_eq
+#define ASSERT_ARRAY_EQ su_assert_array_eq
+#define ASSERT_FLOAT_ARRAY_EQ su_assert_float_array_eq
+#define ASSERT_DOUBLE_ARRAY_EQ su_assert_double_array_eq
+#define ASSERT_ARRAY_NEAR su_assert_array_near
 
 #define EXPECT_EXIT su_expect_exit
 #define EXPECT_DEATH su_expect_death
+#define EXPECT_EXIT_ASYNC su_expect_exit_async
+#define EXPECT_DEATH_ASYNC su_expect_death_async
+#define EXPECT_MAX_ALLOCS su_expect_max_allocs
+#define EXPECT_NO_ALLOC su_expect_no_alloc
+#define EXPECT_LATENCY su_expect_latency
+#define ASSERT_LATENCY su_assert_latency
+#define EXPECT_COMPLEXITY su_expect_complexity
+#define AWAIT_DEATH_TESTS su_await_death_tests
 #endif
 
 #define su_str_inner(x) #x
@@ -78,43 +162,140 @@ typedef enum {
     SU_PASS,
     SU_FAIL,
     SU_SKIP,
+    /// The test did not finish within its timeout.
+    SU_TIMEOUT,
 } su_status_t;
 
-typedef uint16_t su_count_t;
+#define SU_STATUS_COUNT 4
+
+typedef uint32_t su_count_t;
 
 typedef struct {
-    // ms * 10 + one decimal place
+    // nanoseconds
     uint64_t value;
 } su_time_t;
 
 su_time_t su_time_from(struct timespec t);
+su_time_t su_time_now(clockid_t clock);
 su_time_t su_time_add(su_time_t a, su_time_t b);
 su_time_t su_time_sub(su_time_t a, su_time_t b);
 double su_time_ms(su_time_t t);
 
+/// Resource usage of a test, all values are deltas over the test.
+typedef struct {
+    /// Growth of the peak resident set size of the process in kilobytes.
+    long max_rss_kb;
+    long minor_faults;
+    long major_faults;
+    long voluntary_switches;
+    long involuntary_switches;
+} su_usage_t;
+
+/// Performance counters read around each test with `--counters`.
+typedef enum {
+    SU_COUNTER_CYCLES,
+    SU_COUNTER_INSTRUCTIONS,
+    SU_COUNTER_BRANCH_MISSES,
+    SU_COUNTER_L1D_MISSES,
+    SU_COUNTER_LLC_MISSES,
+    SU_COUNTER_DTLB_MISSES,
+    // software counters, only used when no hardware counter is available
+    SU_COUNTER_TASK_CLOCK,
+    SU_COUNTER_PAGE_FAULTS,
+} su_counter_t;
+
+#define SU_COUNTER_COUNT 8
+
+typedef struct {
+    /// User space only, scaled up if the counters were multiplexed.  The task clock is in
+    /// nanoseconds.
+    uint64_t values[SU_COUNTER_COUNT];
+    /// Bit `1 << counter` is set for each counter that was measured.
+    uint32_t mask;
+    /// Iterations of `su_bench_loop` the values cover, `0` for tests.
+    uint64_t iterations;
+} su_counters_t;
+
+/// Heap usage of a test, only recorded when compiled with `SU_TRACK_ALLOCS`.  Sizes are usable
+/// sizes as reported by `malloc_usable_size`.
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;
+    /// Bytes allocated and not freed, negative if the test freed memory allocated before it.
+    int64_t live;
+    int64_t peak_live;
+} su_alloc_stats_t;
+
+/// Allocations of the calling thread since its current test started.
+su_alloc_stats_t su_alloc_stats(void);
+/// Returns `true` (the assertion fails) if more than `max` allocations happened since `before`.
+bool su_check_allocs(
+    su_alloc_stats_t before,
+    uint64_t max,
+    const char *stmt,
+    const char *test_name,
+    int line
+);
+
 typedef struct {
     int pid;
+    // stderr pipe
     int rx;
     int tx;
+    // stdout pipe
+    int out_rx;
+    int out_tx;
+    /// When the child was forked, for `--trace`.
+    su_time_t start;
 } su_subproc_info_t;
 
 su_subproc_info_t su_subproc_begin(void);
 
 typedef struct {
     int status;  // encoded value of waitpid
+    // stb arrays owning the captured output
     char *_stderr_buf;
+    char *_stdout_buf;
+    /// Captured output with leading and trailing whitespace removed.
     const char *standard_error;
+    const char *standard_output;
 } su_subproc_result_t;
 
+/// Drains the output of the child while it runs and waits for it to exit.
 su_subproc_result_t su_subproc_end(su_subproc_info_t info);
+void su_subproc_result_drop(su_subproc_result_t *result);
 
 typedef struct {
     int code_or_signal;
     bool is_signal;
     bool any_abnormal;
-    const char *output;
 } su_subproc_predicate_t;
 
+typedef enum {
+    SU_OUTPUT_EQUALS,
+    SU_OUTPUT_PREFIX,
+    SU_OUTPUT_CONTAINS,
+    /// POSIX extended regular expression, matching anywhere in the output.
+    SU_OUTPUT_REGEX,
+} su_output_kind_t;
+
+/// Expected output of a subprocess, a `NULL` pattern accepts any output.
+typedef struct {
+    su_output_kind_t kind;
+    const char *pattern;
+    /// Match `stdout` instead of `stderr`.
+    bool standard_output;
+} su_output_t;
+
+su_output_t su_output_equals(const char *text);
+su_output_t su_output_prefix(const char *prefix);
+su_output_t su_output_contains(const char *text);
+su_output_t su_output_regex(const char *regex);
+su_output_t su_on_stdout(su_output_t output);
+su_output_t su__output_identity(su_output_t output);
+bool su_output_matches(su_output_t output, const char *text);
+
 su_subproc_predicate_t su_exited_with_code(int code);
 su_subproc_predicate_t su_killed_by_signal(int signal);
 su_subproc_predicate_t su_exited_abnormally(void);
@@ -124,95 +305,451 @@ bool su_subproc_predicate_matches_status(su_subproc_predicate_t predicate, int s
 bool su_check_subproc_result(
     const su_subproc_result_t *result,
     su_subproc_predicate_t predicate,
+    su_output_t output,
+    const char *stmt,
     const char *test_name,
     int line
 );
 
+/// A death test started by `su_expect_exit_async` whose result is not known yet.
+typedef struct {
+    su_subproc_info_t info;
+    /// -1 once the process has been reaped, or if pidfds are not supported.
+    int pidfd;
+    /// The process has been reaped, its output may still be pending.
+    bool exited;
+    su_subproc_predicate_t predicate;
+    su_output_t output;
+    const char *stmt;
+    int line;
+    su_subproc_result_t result;
+} su_subproc_pending_t;
+
+/// Death tests running concurrently, a zero-initialized batch is empty.
+typedef struct {
+    int epoll_fd;
+    su_subproc_pending_t *pending;  // stb array
+    size_t running;
+} su_subproc_batch_t;
+
+void su_subproc_batch_add(
+    su_subproc_batch_t *batch,
+    su_subproc_info_t info,
+    su_subproc_predicate_t predicate,
+    su_output_t output,
+    const char *stmt,
+    int line
+);
+/// Waits for all children of the batch and checks them, returns `true` if any of them failed.
+/// The batch is empty afterwards.
+bool su_subproc_batch_wait(su_subproc_batch_t *batch, const char *test_name);
+
+typedef enum {
+    /// Not fitted or not expected.
+    SU_COMPLEXITY_NONE,
+    SU_O_1,
+    SU_O_LOG_N,
+    SU_O_N,
+    SU_O_N_LOG_N,
+    SU_O_N2,
+} su_complexity_t;
+
+#define SU_COMPLEXITY_COUNT 6
+
+typedef struct {
+    uint64_t n;
+    /// Nanoseconds per iteration.
+    double median;
+    /// Declared with `su_bench_bytes` and `su_bench_items` at this size.
+    double bytes;
+    double items;
+} su_bench_point_t;
+
+typedef struct {
+    /// Must outlive the run, usually a string literal.
+    const char *name;
+    double value;
+    /// Reported per second instead of per iteration.
+    bool rate;
+} su_bench_counter_t;
+
+/// Declared inside a benchmark with `su_bench_bytes`, `su_bench_items`, and `su_bench_counter`.
+typedef struct {
+    /// Processed by each iteration, `0` if not declared.
+    double bytes;
+    double items;
+    /// Totals of one call while running, per iteration or second in the statistics.
+    su_bench_counter_t counters[SU_BENCH_COUNTERS];
+    uint32_t counter_count;
+} su_bench_throughput_t;
+
+typedef struct {
+    // all values are nanoseconds per iteration
+    double mean;
+    double median;
+    double stddev;
+    double min;
+    uint64_t iterations;
+    /// Sorted.
+    double samples[SU_BENCH_SAMPLES];
+    /// Median of each size of a `su_bench_range`, the values above are those of the largest.
+    su_bench_point_t points[SU_BENCH_RANGE_POINTS];
+    uint32_t point_count;
+    /// Class fitting the points best, with the RMS of its residuals relative to each time.
+    su_complexity_t complexity;
+    double complexity_rms;
+    su_bench_throughput_t throughput;
+} su_bench_stats_t;
+
+/// Samples of a benchmark from an earlier run, in nanoseconds per iteration.
+typedef struct {
+    char *name;
+    double *samples;  // stb array
+} su_baseline_t;
+
+typedef enum {
+    /// Caches keep what the previous sample left in them.
+    SU_BENCH_CACHE_KEEP,
+    /// Data caches are evicted right before each sample is timed.
+    SU_BENCH_CACHE_FLUSH,
+    /// The benchmark runs once more, untimed, before each sample.
+    SU_BENCH_CACHE_WARM,
+} su_bench_cache_t;
+
+/// Declared by `su_bench_options`.
+typedef struct {
+    /// Pin the thread to the CPU it is running on while the benchmark runs.
+    bool pin;
+    /// Run the benchmark for this long before calibrating it, the results are discarded.
+    unsigned warmup_ms;
+    su_bench_cache_t cache;
+} su_bench_options_t;
+
+typedef struct {
+    /// Number of iterations the current call of the benchmark should run.
+    uint64_t iterations;
+    su_time_t start;
+    su_time_t elapsed;
+    bool measured;
+    su_bench_stats_t stats;
+    /// Set when running with `--baseline` and the file has samples of this benchmark.
+    const su_baseline_t *baseline;
+    /// Sizes of a `su_bench_range`: `lo`, `lo * mult`, ... up to `hi`, `mult` is `0` otherwise.
+    uint64_t range_lo;
+    uint64_t range_hi;
+    uint64_t range_mult;
+    /// Size the current call of the benchmark should use.
+    uint64_t n;
+    /// Set by `su_expect_complexity`.
+    su_complexity_t expected_complexity;
+    su_bench_options_t options;
+    /// Declared by the current call of the benchmark.
+    su_bench_throughput_t call;
+} su_bench_t;
+
+typedef struct {
+    su_bench_t *bench;
+    su_bench_options_t options;
+} su_bench_options_def_t;
+
+uint64_t su_bench_start(su_bench_t *bench);
+bool su_bench_stop(su_bench_t *bench);
+/// `"O(1)"`, `"O(log n)"`, ...
+const char *su_complexity_name(su_complexity_t complexity);
+/// Fits `c * f(n)` for each class by least squares on the residuals relative to the times,
+/// returns the one with the smallest RMS.
+su_complexity_t su_fit_complexity(const su_bench_point_t *points, size_t count, double *rms);
+
 typedef struct su_test su_test_t;
+typedef struct su_module su_module_t;
+/// Adds `value` to the counter `name` of the current call of the benchmark.
+void su_bench_add_counter(su_test_t *test, const char *name, double value, bool rate, int line);
+
+/// Failures of one assertion of a test.
+typedef struct {
+    int line;
+    /// Text of the assertion, tells apart assertions expanded on the same line.
+    const char *expr;
+    uint64_t count;
+    /// Distinct values printed so far (stb array).
+    char **values;
+    /// Nothing more is printed for this assertion.
+    bool full;
+} su_failure_t;
+
+/// Counts a failure of the assertion `expr` at `line` of the running test, returns `NULL`
+/// outside of tests.  Assertions are told apart by the address of `expr`, a string literal.
+su_failure_t *su_failure_count(int line, const char *expr);
+/// Returns whether to print a failure: the first time for a `NULL` value, otherwise if `value`
+/// is one of the first `SU_FAILURE_VALUES` distinct ones.
+bool su_failure_novel(su_failure_t *failure, const char *value);
 
 typedef void (*su_stateless_test_fn_t)(su_test_t *);
 typedef void (*su_fixture_test_fn_t)(su_test_t *, void *);
 typedef void *su_test_fn_t;
 
+typedef struct {
+    size_t object_size;
+    void (*setup)(void *);
+    void (*tear_down)(void *);
+} su_fixture_def_t;
+
+/// Used to keep the declaration order of tests, every translation unit has its own.
+typedef struct {
+    size_t rank;
+} su_translation_unit_t;
+
+static su_translation_unit_t su__translation_unit __attribute__((unused));
+
+/// Tests are statically initialized by the `su_test` macros, a pointer to each of them is placed
+/// in the `su_tests` section where they get collected from by `su_state_init`.
 struct su_test {
     const char *name;
+    /// `module.test`
+    const char *pretty_name;
+    const char *module_name;
+    su_module_t *module;
+    /// Only set for tests of fixtures.
+    const su_fixture_def_t *fixture;
+    su_translation_unit_t *translation_unit;
+    /// Position inside the translation unit.
+    size_t counter;
+    /// Comma or space separated tags, may be `NULL`.
+    const char *tags;
+    /// Position inside the state once initialized.
+    uint64_t order;
+    /// Set by `su_test_timeout` or `su_module_timeout`, `0` uses the global timeout.
+    uint32_t timeout_ms;
     su_status_t status;
     su_time_t runtime;
+    /// CPU time of the thread running the test.
+    su_time_t cpu_time;
+    su_usage_t usage;
+    su_counters_t counters;
+    su_alloc_stats_t allocs;
+    /// Assertions that failed during the current run (stb array).
+    su_failure_t *failures;
     su_test_fn_t fn;
+    /// Non-NULL for benchmarks.
+    su_bench_t *bench;
+    /// Captured output of a failed test until its module was reported (stb array).
+    char *output;
 };
 
 typedef struct {
-    void (*init)(void *);
-    void (*clean)(void *);
-    void (*run)(void *, su_test_t *);
+    /// Creates the object passed to `run` and `clean`, called once per module and thread.
+    void *(*init)(void *);
+    void (*clean)(void *, void *);
+    void (*run)(void *, void *, su_test_t *);
 } su_module_vtable_t;
 
-typedef struct {
+struct su_module {
     const su_module_vtable_t *vtable;
-    su_test_t *tests;
+    su_test_t **tests;
+    size_t test_count;
     const char *name;
     su_time_t runtime;
-    su_count_t counts[3];
-} su_module_t;
+    su_count_t counts[SU_STATUS_COUNT];
+    /// The next module in declaration order.
+    su_module_t *next;
+    size_t index;
+    bool registered;
+};
+
+typedef struct su_reporter su_reporter_t;
+
+void su_module_run_test(su_module_t *mod, void *object, su_test_t *test);
+void su_module_run(su_module_t *mod, su_reporter_t *reporter);
 
-void su_module_run_test(su_module_t *mod, su_test_t *test);
-void su_module_run(su_module_t *mod);
+/// The test currently running on this thread.
+extern _Thread_local su_test_t *su__current_test;
+
+typedef enum {
+    /// `setup` runs once and all tests share the object.
+    SU_FIXTURE_SHARED,
+    /// `setup` runs once, each test gets a copy of the object made with `clone` or `memcpy`.
+    SU_FIXTURE_SNAPSHOT,
+    /// `setup` runs once, each test runs in a forked process.
+    SU_FIXTURE_FORK,
+} su_fixture_mode_t;
 
 typedef struct {
     su_module_t mod;
-    void *fixture;
     size_t object_size;
     void (*setup)(void *);
     void (*tear_down)(void *);
+    su_fixture_mode_t mode;
+    /// Deep copies `src` into `dst` in snapshot mode, copies are destroyed with `tear_down`.
+    void (*clone)(void *dst, const void *src);
 } su_fixture_owner_t;
 
+typedef struct {
+    su_fixture_owner_t *owner;
+    su_fixture_mode_t mode;
+    void (*clone)(void *dst, const void *src);
+} su_fixture_mode_def_t;
+
+/// Declared by `su_module_timeout` and `su_test_timeout`.
+typedef struct {
+    const char *module_name;
+    /// `NULL` for the whole module.
+    const char *test_name;
+    uint32_t ms;
+} su_timeout_def_t;
+
 typedef struct {
     bool skip_death_tests;
+    /// Number of worker processes modules are distributed to, `1` runs everything in-process.
+    unsigned jobs;
+    /// Number of threads tests are distributed to when not using multiple jobs.
+    unsigned threads;
+    /// Time each benchmark should take after calibration.
+    unsigned bench_time_ms;
+    /// Print CPU time and resource usage of each test.
+    bool timing;
+    /// Read performance counters around each test.
+    bool counters;
+    /// Directory the folded stacks sampled from each test are written to, may be `NULL`.
+    const char *profile_dir;
+    /// File a Chrome trace of the run is written to, may be `NULL`.
+    const char *trace_path;
+    /// Capture stdout and stderr of each test and only print them if it fails.
+    bool capture;
+    /// Timeout of tests without their own timeout, `0` disables it.
+    unsigned timeout_ms;
+    /// File recording the status and runtime of tests across runs, may be `NULL`.
+    const char *history_path;
+    /// Name of the reporter: `console`, `junit`, `jsonl`, or `tap`.
+    const char *reporter;
+    /// File the reporter writes to, `NULL` for stdout.
+    const char *report_file;
+    /// File benchmarks are compared against, may be `NULL`.
+    const char *baseline_path;
+    /// Write the samples of the benchmarks into `baseline_path` instead of comparing.
+    bool update_baseline;
+    /// Benchmarks fail if significantly slower than their baseline by this many percent.
+    unsigned regression_threshold;
+    /// `:` separated glob patterns matched against `module.test`, patterns starting with `-`
+    /// exclude tests (stb_ds array).
+    const char **filters;
+    /// Tags to select, tags starting with `-` exclude tests (stb_ds array).
+    const char **tags;
+    /// Print the selected tests instead of running them.
+    bool list;
 } su_options_t;
 
 void su_options_default(su_options_t *options);
+/// Parse command line arguments into `options`, returns `false` if they are invalid.
+bool su_options_parse(su_options_t *options, int argc, char **argv);
+/// Free the memory of the options.
+void su_options_drop(su_options_t *options);
+/// Returns `true` if the test is selected by the filters and tags of `options`.
+bool su_options_select(const su_options_t *options, const su_test_t *test);
 
 typedef struct {
-    su_count_t counts[3];
+    su_count_t counts[SU_STATUS_COUNT];
     su_time_t runtime;
 } su_result_t;
 
+/// Receives the results as tests finish, modules are reported one after another.
 typedef struct {
-    su_module_t **modules;
+    /// Called before any test runs with the number of selected tests.
+    void (*begin)(su_reporter_t *reporter, size_t test_count);
+    void (*module_begin)(su_reporter_t *reporter, const su_module_t *mod);
+    void (*test_end)(su_reporter_t *reporter, const su_test_t *test);
+    void (*module_end)(su_reporter_t *reporter, const su_module_t *mod);
+    void (*end)(su_reporter_t *reporter, const su_result_t *result);
+} su_reporter_vtable_t;
 
-    struct {
-        const char *key;
-        su_module_t *value;
-    } *modules_by_name;
+struct su_reporter {
+    const su_reporter_vtable_t *vtable;
+    FILE *out;
+    /// Use ANSI escape codes, only when `out` is a terminal.
+    bool color;
+    /// Print resource usage of each test.
+    bool timing;
+    /// Number of tests reported so far.
+    size_t test_number;
+};
 
-    struct {
-        const char *key;
-        su_fixture_owner_t *value;
-    } *fixtures_by_name;
+/// Returns the reporter called `name`, or `NULL` if there is none.
+const su_reporter_vtable_t *su_find_reporter(const char *name);
+/// Opens the reporter selected by the options, returns `false` if its file cannot be opened.
+bool su_reporter_open(su_reporter_t *reporter, const su_options_t *options);
+void su_reporter_close(su_reporter_t *reporter);
 
-    struct {
-        const char *key;
-        const char *value;
-    } *test_names;
+/// History of a test, keyed by the hash of its pretty name.
+typedef struct {
+    /// FNV-1a hash of `module.test`, `0` marks an empty slot.
+    uint64_t hash;
+    /// Exponential moving average of the runtime in nanoseconds.
+    uint64_t runtime;
+    uint32_t status;
+    uint32_t runs;
+    /// `module.test`, cut off if longer, to tell apart tests whose names have the same hash.
+    char name[104];
+} su_history_entry_t;
+
+typedef struct {
+    char magic[8];
+    /// Number of slots, a power of two.
+    uint64_t capacity;
+    uint64_t count;
+} su_history_header_t;
+
+/// A memory-mapped open-addressing hash table of `su_history_entry_t`.
+typedef struct {
+    int fd;
+    size_t size;
+    su_history_header_t *header;
+    su_history_entry_t *entries;
+} su_history_t;
+
+/// Opens or creates the history file with room for `test_count` more tests, returns `false` if
+/// it cannot be used.
+bool su_history_open(su_history_t *history, const char *path, size_t test_count);
+/// Returns the entry of the test or `NULL` if there is none and `insert` is `false`.
+su_history_entry_t *su_history_lookup(su_history_t *history, const char *name, bool insert);
+void su_history_close(su_history_t *history);
+
+/// One-sided Mann-Whitney U test, returns the probability of samples `y` being at least as far
+/// above `x` as they are if both came from the same distribution.
+double su_mann_whitney_p(const double *x, size_t n, const double *y, size_t m);
+
+typedef struct {
+    /// First module in declaration order.
+    su_module_t *modules;
+    size_t module_count;
+    /// All tests grouped by module, each module's tests point into this.
+    su_test_t **tests;
+    size_t test_count;
+    bool initialized;
 
     su_options_t options;
+    su_reporter_t reporter;
+    /// Loaded from `options.baseline_path`, sorted by name (stb array).
+    su_baseline_t *baselines;
+    /// Indices into `tests` in the order threads should start them, `NULL` for declaration order.
+    uint32_t *thread_order;
     // we want runtime defaults so we cannot statically initialize options
     // with their default values
     bool options_initialized;
 } su_state_t;
 
-/// Get or create a module.
-su_module_t *su_state_get_module(su_state_t *state, const char *name);
-/// Get or create a fixture owner.
-su_fixture_owner_t *su_state_get_fixture(su_state_t *state, const char *name);
-/// Set a pretty test function name.
-void su_state_set_test_name(su_state_t *state, const char *function_name, const char *pretty_name);
-/// Get a pretty test function name.
-const char *
-su_state_test_name(su_state_t *state, const char *function_name, const char *pretty_name);
+/// Collect all registered tests and modules, this does not allocate.
+void su_state_init(su_state_t *state);
+/// Narrow the state down to the tests selected by its options, modules without selected tests
+/// are removed.
+void su_state_select(su_state_t *state);
+/// Reorders the modules so those with tests that failed last time run first, and when using
+/// multiple jobs the modules that took longest run next.  With multiple threads the tests are
+/// ordered the same way in `thread_order`.
+void su_state_schedule(su_state_t *state, su_history_t *history);
+/// Records the results of all tests of the state in the history.
+void su_state_record(const su_state_t *state, su_history_t *history);
 /// Run all tests in the state.
 su_result_t su_state_run(su_state_t *state);
-/// Free all memory of the state.
+/// Reset the state.
 void su_state_drop(su_state_t *state);
 
 extern su_state_t su__state;
@@ -228,44 +765,267 @@ typedef struct {
 su_float_t su_float_float(float a);
 su_float_t su_float_double(double a);
 bool su_float_eq(su_float_t a, su_float_t b);
+/// Distance in ULPs, `UINT64_MAX` if the values are never almost equal (NaNs, an infinity and a
+/// finite value, or different signs).
+uint64_t su_float_distance(su_float_t a, su_float_t b);
+
+/// Array versions of `su_float_eq` and `su_expect_near`, they return `true` (the assertion
+/// fails) if any element is too far off after printing how far.
+bool su_check_float_array_eq(
+    const float *a,
+    const float *b,
+    size_t n,
+    uint64_t max_ulps,
+    const char *expr,
+    const char *test_name,
+    int line
+);
+bool su_check_double_array_eq(
+    const double *a,
+    const double *b,
+    size_t n,
+    uint64_t max_ulps,
+    const char *expr,
+    const char *test_name,
+    int line
+);
+bool su_check_float_array_near(
+    const float *a,
+    const float *b,
+    size_t n,
+    double abs_err,
+    const char *expr,
+    const char *test_name,
+    int line
+);
+bool su_check_double_array_near(
+    const double *a,
+    const double *b,
+    size_t n,
+    double abs_err,
+    const char *expr,
+    const char *test_name,
+    int line
+);
 
 bool su_streq(const char *a, const char *b);
 
+/// Buckets covering all of `uint64_t`.
+#define SU_HISTOGRAM_BUCKETS ((64 - SU_HISTOGRAM_SUB_BITS + 1) << SU_HISTOGRAM_SUB_BITS)
+
+/// Log-bucketed histogram of nanoseconds, see `su_expect_latency`.
+typedef struct {
+    uint64_t counts[SU_HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} su_histogram_t;
+
+void su_histogram_record(su_histogram_t *histogram, uint64_t value);
+/// Upper bound of the bucket holding the value at `percentile` (0 to 100), at most the maximum.
+uint64_t su_histogram_percentile(const su_histogram_t *histogram, double percentile);
+/// Returns `true` (the assertion fails) if a percentile is above its limit, `0` has no limit,
+/// after printing the distribution.
+bool su_check_latency(
+    const su_histogram_t *histogram,
+    uint64_t p50,
+    uint64_t p99,
+    uint64_t p999,
+    const char *stmt,
+    const char *test_name,
+    int line
+);
+
+/// Compares `size` bytes of elements of `element_size` bytes, returns `true` (the assertion
+/// fails) if they differ after printing where.
+bool su_check_mem_eq(
+    const void *a,
+    const void *b,
+    size_t size,
+    size_t element_size,
+    const char *expr,
+    const char *test_name,
+    int line
+);
+
 /// Returns 0 if no tests failed.
 int su_run_all_tests(void);
+/// Like `su_run_all_tests` but parses options from the command line first, returns 2 if they
+/// are invalid.
+int su_run_all_tests_argv(int argc, char **argv);
 
 void su_release_state(void);
 
 #define su_test_name(_mod, _test) su_test_##_mod##_##_test
 
-#define su_test(_mod, _test)                                                                     \
-    void su_test_name(_mod, _test)(su_test_t *);                                                 \
-    static void __attribute__((constructor)) su_cat3(su__register_, _mod, _test)() {             \
-        su_module_t *mod = su_state_get_module(&su__state, su_str(_mod));                        \
-        su_test_t *test = su_arrpush(mod->tests);                                                \
-        test->name = su_str(_test);                                                              \
-        test->fn = (su_test_fn_t)su_test_name(_mod, _test);                                      \
-        su_state_set_test_name(&su__state, su_str(su_test_name(_mod, _test)), #_mod "." #_test); \
-    }                                                                                            \
+#define su_module_name(_mod) su__module_##_mod
+
+#define su__register(_mod, _test, _module, _fixture, _bench, _tags) \
+    static su_test_t su__test_##_mod##_##_test = {                  \
+        .name = #_test,                                             \
+        .pretty_name = #_mod "." #_test,                            \
+        .module_name = #_mod,                                       \
+        .module = (_module),                                        \
+        .fixture = (_fixture),                                      \
+        .translation_unit = &su__translation_unit,                  \
+        .counter = __COUNTER__,                                     \
+        .tags = (_tags),                                            \
+        .fn = (su_test_fn_t)su_test_name(_mod, _test),              \
+        .bench = (_bench),                                          \
+    };                                                              \
+    static su_test_t *su__test_ptr_##_mod##_##_test                 \
+        __attribute__((used, section("su_tests"))) = &su__test_##_mod##_##_test
+
+#define su__register_fixture(_fixture, _test, _bench, _tags)           \
+    static const su_fixture_def_t su__fixture_##_fixture##_##_test = { \
+        .object_size = sizeof(_fixture),                               \
+        .setup = (void (*)(void *))_fixture##_setup,                   \
+        .tear_down = (void (*)(void *))_fixture##_tear_down,           \
+    };                                                                 \
+    su__register(                                                      \
+        _fixture,                                                      \
+        _test,                                                         \
+        &su_module_name(_fixture).mod,                                 \
+        &su__fixture_##_fixture##_##_test,                             \
+        _bench,                                                        \
+        _tags                                                          \
+    )
+
+/// `_tags` is a string of comma or space separated tags.
+#define su_tagged_test(_mod, _test, _tags)                               \
+    __attribute__((weak)) su_module_t su_module_name(_mod);              \
+    void su_test_name(_mod, _test)(su_test_t *);                         \
+    su__register(_mod, _test, &su_module_name(_mod), NULL, NULL, _tags); \
     void su_test_name(_mod, _test)(su_test_t * su_self)
 
-#define su_test_f(_fixture, _test)                                                        \
-    void su_test_name(_fixture, _test)(su_test_t *, _fixture *);                          \
-    static void __attribute__((constructor)) su_cat3(su__register_, _fixture, _test)() {  \
-        su_fixture_owner_t *fixture = su_state_get_fixture(&su__state, su_str(_fixture)); \
-        su_test_t *test = su_arrpush(fixture->mod.tests);                                 \
-        test->name = su_str(_test);                                                       \
-        test->fn = (su_test_fn_t)su_test_name(_fixture, _test);                           \
-        fixture->object_size = sizeof(_fixture);                                          \
-        fixture->setup = (void (*)(void *))_fixture##_setup;                              \
-        fixture->tear_down = (void (*)(void *))_fixture##_tear_down;                      \
-        su_state_set_test_name(                                                           \
-            &su__state, su_str(su_test_name(_fixture, _test)), #_fixture "." #_test       \
-        );                                                                                \
-    }                                                                                     \
+#define su_tagged_test_f(_fixture, _test, _tags)                       \
+    __attribute__((weak)) su_fixture_owner_t su_module_name(_fixture); \
+    void su_test_name(_fixture, _test)(su_test_t *, _fixture *);       \
+    su__register_fixture(_fixture, _test, NULL, _tags);                \
     void su_test_name(_fixture, _test)(su_test_t * su_self, _fixture * SU_FIXTURE_IDENTIFIER)
 
-#define su_pretty_function() su_state_test_name(&su__state, __func__, __PRETTY_FUNCTION__)
+#define su__fixture_mode(_fixture, _mode, _clone)                       \
+    __attribute__((weak)) su_fixture_owner_t su_module_name(_fixture);  \
+    static const su_fixture_mode_def_t su__fixture_mode_##_fixture = {  \
+        .owner = &su_module_name(_fixture),                             \
+        .mode = (_mode),                                                \
+        .clone = (_clone),                                              \
+    };                                                                  \
+    static const su_fixture_mode_def_t *su__fixture_mode_ptr_##_fixture \
+        __attribute__((used, section("su_fixture_modes"))) = &su__fixture_mode_##_fixture
+
+/// Run `setup` once and restore a byte copy of the fixture before each test.
+#define su_fixture_snapshot(_fixture) su__fixture_mode(_fixture, SU_FIXTURE_SNAPSHOT, NULL)
+/// Like `su_fixture_snapshot` but copies are made with `<fixture>_clone(dst, src)` and destroyed
+/// with `<fixture>_tear_down`.
+#define su_fixture_snapshot_clone(_fixture)              \
+    su__fixture_mode(                                    \
+        _fixture,                                        \
+        SU_FIXTURE_SNAPSHOT,                             \
+        (void (*)(void *, const void *))_fixture##_clone \
+    )
+/// Run `setup` once and each test in a forked process, sharing the fixture copy-on-write.
+#define su_fixture_fork(_fixture) su__fixture_mode(_fixture, SU_FIXTURE_FORK, NULL)
+
+#define su__timeout(_name, _mod, _test, _ms)                                             \
+    static const su_timeout_def_t su__timeout_##_name = {                                \
+        .module_name = (_mod),                                                           \
+        .test_name = (_test),                                                            \
+        .ms = (_ms),                                                                     \
+    };                                                                                   \
+    static const su_timeout_def_t *su__timeout_ptr_##_name                               \
+        __attribute__((used, section("su_timeouts"))) = &su__timeout_##_name
+
+/// Tests of the module time out after `_ms` milliseconds, overrides the global timeout.
+#define su_module_timeout(_mod, _ms) su__timeout(_mod, #_mod, NULL, _ms)
+/// The test times out after `_ms` milliseconds, overrides the module and global timeouts.
+#define su_test_timeout(_mod, _test, _ms) su__timeout(_mod##_##_test, #_mod, #_test, _ms)
+
+#define su_test(_mod, _test) su_tagged_test(_mod, _test, NULL)
+#define su_test_f(_fixture, _test) su_tagged_test_f(_fixture, _test, NULL)
+
+#define su_bench_name(_mod, _bench) su__bench_##_mod##_##_bench
+
+#define su_bench(_mod, _bench)                                                                   \
+    __attribute__((weak)) su_module_t su_module_name(_mod);                                      \
+    static su_bench_t su_bench_name(_mod, _bench);                                               \
+    void su_test_name(_mod, _bench)(su_test_t *);                                                \
+    su__register(_mod, _bench, &su_module_name(_mod), NULL, &su_bench_name(_mod, _bench), NULL); \
+    void su_test_name(_mod, _bench)(su_test_t * su_self)
+
+#define su_bench_f(_fixture, _bench)                                                \
+    __attribute__((weak)) su_fixture_owner_t su_module_name(_fixture);              \
+    static su_bench_t su_bench_name(_fixture, _bench);                              \
+    void su_test_name(_fixture, _bench)(su_test_t *, _fixture *);                   \
+    su__register_fixture(_fixture, _bench, &su_bench_name(_fixture, _bench), NULL); \
+    void su_test_name(_fixture, _bench)(su_test_t * su_self, _fixture * SU_FIXTURE_IDENTIFIER)
+
+#define su__bench_range(_mod, _bench, _lo, _hi, _mult) \
+    static su_bench_t su_bench_name(_mod, _bench) = {   \
+        .range_lo = (_lo),                              \
+        .range_hi = (_hi),                              \
+        .range_mult = (_mult),                          \
+    }
+
+/// A benchmark run for each size `_lo`, `_lo * _mult`, ... up to `_hi`, see `su_bench_n`.
+#define su_bench_range(_mod, _bench, _lo, _hi, _mult)                                            \
+    __attribute__((weak)) su_module_t su_module_name(_mod);                                      \
+    su__bench_range(_mod, _bench, _lo, _hi, _mult);                                              \
+    void su_test_name(_mod, _bench)(su_test_t *);                                                \
+    su__register(_mod, _bench, &su_module_name(_mod), NULL, &su_bench_name(_mod, _bench), NULL); \
+    void su_test_name(_mod, _bench)(su_test_t * su_self)
+
+#define su_bench_range_f(_fixture, _bench, _lo, _hi, _mult)                         \
+    __attribute__((weak)) su_fixture_owner_t su_module_name(_fixture);              \
+    su__bench_range(_fixture, _bench, _lo, _hi, _mult);                             \
+    void su_test_name(_fixture, _bench)(su_test_t *, _fixture *);                   \
+    su__register_fixture(_fixture, _bench, &su_bench_name(_fixture, _bench), NULL); \
+    void su_test_name(_fixture, _bench)(su_test_t * su_self, _fixture * SU_FIXTURE_IDENTIFIER)
+
+/// Sets the `su_bench_options_t` of a benchmark declared before, e.g.
+/// `su_bench_options(mod, bench, .pin = true, .cache = SU_BENCH_CACHE_FLUSH)`.
+#define su_bench_options(_mod, _bench, ...)                                          \
+    static const su_bench_options_def_t su__bench_options_##_mod##_##_bench = {      \
+        .bench = &su_bench_name(_mod, _bench),                                       \
+        .options = {__VA_ARGS__},                                                    \
+    };                                                                               \
+    static const su_bench_options_def_t *su__bench_options_ptr_##_mod##_##_bench     \
+        __attribute__((used, section("su_bench_options"))) = &su__bench_options_##_mod##_##_bench
+
+/// The input size of the current run of a `su_bench_range`.
+#define su_bench_n() (su_self->bench->n)
+
+/// Bytes and items each iteration of `su_bench_loop` processes, reported per second.
+#define su_bench_bytes(_n) (su_self->bench->call.bytes = (double)(_n))
+#define su_bench_items(_n) (su_self->bench->call.items = (double)(_n))
+
+/// Adds to a counter of the benchmark, `_value` is the total of the whole `su_bench_loop`.
+/// `su_bench_counter` reports it per iteration, `su_bench_rate` per second.
+#define su_bench_counter(_name, _value) \
+    su_bench_add_counter(su_self, (_name), (double)(_value), false, __LINE__)
+#define su_bench_rate(_name, _value) \
+    su_bench_add_counter(su_self, (_name), (double)(_value), true, __LINE__)
+
+/// Fails the `su_bench_range` if its times grow faster than `_complexity` (e.g. `SU_O_N`).
+#define su_expect_complexity(_complexity) (su_self->bench->expected_complexity = (_complexity))
+
+/// The timed loop of a benchmark, the framework decides how often it runs.
+#define su_bench_loop                                                \
+    for (uint64_t su__i = 0, su__n = su_bench_start(su_self->bench); \
+         su__i < su__n || !su_bench_stop(su_self->bench);            \
+         ++su__i)
+
+/// Forces the compiler to assume the value of `_x` is used.
+#define su_do_not_optimize(_x)                               \
+    do {                                                     \
+        su_typeof(_x) su__value = (_x);                      \
+        __asm__ volatile("" : : "r"(&su__value) : "memory"); \
+    } while (0)
+
+/// Forces the compiler to assume all memory may have been read and written.
+#define su_clobber_memory() __asm__ volatile("" : : : "memory")
+
+#define su_pretty_function() (su_self->pretty_name)
 
 #define su_skip()                         \
     do {                                  \
@@ -278,9 +1038,15 @@ void su_release_state(void);
 #define su_assert_impl(_expr, _msg, _fatal)                                                    \
     do {                                                                                       \
         if (!(_expr)) {                                                                        \
-            fprintf(                                                                           \
-                stderr, "%s(%d): Assertion failed: %s\n", su_pretty_function(), __LINE__, _msg \
-            );                                                                                 \
+            if (su_failure_novel(su_failure_count(__LINE__, _msg), NULL)) {                    \
+                fprintf(                                                                       \
+                    stderr,                                                                    \
+                    "%s(%d): Assertion failed: %s\n",                                          \
+                    su_pretty_function(),                                                      \
+                    __LINE__,                                                                  \
+                    _msg                                                                       \
+                );                                                                             \
+            }                                                                                  \
             su_self->status = SU_FAIL;                                                         \
             if (_fatal) {                                                                      \
                 return;                                                                        \
@@ -313,6 +1079,116 @@ void su_release_state(void);
 #define su_assert_near(_a, _b, _tolerance) \
     su_assert_impl(fabs((_a) - (_b)) <= (_tolerance), #_a " == " #_b, true)
 
+#define su_float_array_impl(_check, _a, _b, _n, _limit, _fatal)                                \
+    do {                                                                                       \
+        if (_check(_a, _b, _n, _limit, #_a " == " #_b, su_pretty_function(), __LINE__)) {      \
+            su_self->status = SU_FAIL;                                                         \
+            if (_fatal) {                                                                      \
+                return;                                                                        \
+            }                                                                                  \
+        }                                                                                      \
+    } while (0)
+
+#define su_check_array_near(_a)                  \
+    _Generic(                                    \
+        *(_a),                                   \
+        float: su_check_float_array_near,        \
+        double: su_check_double_array_near       \
+    )
+
+/// The first `_n` elements of the arrays are within `_max_ulps` ULP's from each other.
+#define su_expect_float_array_eq(_a, _b, _n, _max_ulps) \
+    su_float_array_impl(su_check_float_array_eq, _a, _b, _n, _max_ulps, false)
+#define su_expect_double_array_eq(_a, _b, _n, _max_ulps) \
+    su_float_array_impl(su_check_double_array_eq, _a, _b, _n, _max_ulps, false)
+/// The first `_n` elements of the float or double arrays differ by at most `_tolerance`.
+#define su_expect_array_near(_a, _b, _n, _tolerance) \
+    su_float_array_impl(su_check_array_near(_a), _a, _b, _n, _tolerance, false)
+#define su_assert_float_array_eq(_a, _b, _n, _max_ulps) \
+    su_float_array_impl(su_check_float_array_eq, _a, _b, _n, _max_ulps, true)
+#define su_assert_double_array_eq(_a, _b, _n, _max_ulps) \
+    su_float_array_impl(su_check_double_array_eq, _a, _b, _n, _max_ulps, true)
+#define su_assert_array_near(_a, _b, _n, _tolerance) \
+    su_float_array_impl(su_check_array_near(_a), _a, _b, _n, _tolerance, true)
+
+#define su_mem_eq_impl(_a, _b, _size, _element_size, _msg, _fatal)                              \
+    do {                                                                                       \
+        if (su_check_mem_eq(                                                                   \
+                _a, _b, _size, _element_size, _msg, su_pretty_function(), __LINE__             \
+            )) {                                                                               \
+            su_self->status = SU_FAIL;                                                         \
+            if (_fatal) {                                                                      \
+                return;                                                                        \
+            }                                                                                  \
+        }                                                                                      \
+    } while (0)
+
+#define su_array_eq_impl(_a, _b, _count, _fatal)                                               \
+    do {                                                                                       \
+        _Static_assert(                                                                        \
+            __builtin_types_compatible_p(typeof(*(_a)), typeof(*(_b))),                        \
+            "arrays of different types"                                                        \
+        );                                                                                     \
+        su_mem_eq_impl(                                                                        \
+            _a, _b, (_count) * sizeof(*(_a)), sizeof(*(_a)), #_a " == " #_b, _fatal            \
+        );                                                                                     \
+    } while (0)
+
+/// The `_n` bytes at `_a` and `_b` are equal.
+#define su_expect_mem_eq(_a, _b, _n) su_mem_eq_impl(_a, _b, _n, 1, #_a " == " #_b, false)
+/// The first `_count` elements of the arrays are bitwise equal.
+#define su_expect_array_eq(_a, _b, _count) su_array_eq_impl(_a, _b, _count, false)
+#define su_assert_mem_eq(_a, _b, _n) su_mem_eq_impl(_a, _b, _n, 1, #_a " == " #_b, true)
+#define su_assert_array_eq(_a, _b, _count) su_array_eq_impl(_a, _b, _count, true)
+
+#ifdef SU_TRACK_ALLOCS
+/// `_stmt` performs at most `_n` allocations.
+#define su_expect_max_allocs(_stmt, _n)                                                         \
+    do {                                                                                        \
+        const su_alloc_stats_t su_before = su_alloc_stats();                                    \
+        _stmt;                                                                                  \
+        if (su_check_allocs(su_before, _n, #_stmt, su_pretty_function(), __LINE__)) {          \
+            su_self->status = SU_FAIL;                                                          \
+        }                                                                                       \
+    } while (0)
+#else
+#define su_expect_max_allocs(_stmt, _n) \
+    _Static_assert(0, "su_expect_max_allocs requires SU_TRACK_ALLOCS")
+#endif
+
+#define su_expect_no_alloc(_stmt) su_expect_max_allocs(_stmt, 0)
+
+#define su_latency_impl(_stmt, _reps, _p50, _p99, _p999, _fatal)                                \
+    do {                                                                                        \
+        su_histogram_t su_histogram = {0};                                                      \
+        for (uint64_t su_rep = 0; su_rep < (uint64_t)(_reps); ++su_rep) {                       \
+            const su_time_t su_start = su_time_now(CLOCK_MONOTONIC);                            \
+            _stmt;                                                                              \
+            su_histogram_record(                                                                \
+                &su_histogram, su_time_sub(su_time_now(CLOCK_MONOTONIC), su_start).value        \
+            );                                                                                  \
+        }                                                                                       \
+        if (su_check_latency(                                                                   \
+                &su_histogram, _p50, _p99, _p999, #_stmt, su_pretty_function(), __LINE__        \
+            )) {                                                                                \
+            su_self->status = SU_FAIL;                                                          \
+            if (_fatal) {                                                                       \
+                return;                                                                         \
+            }                                                                                   \
+        }                                                                                       \
+    } while (0)
+
+/// Runs `_stmt` `_reps` times, the 50th, 99th, and 99.9th percentile of its latency must be at
+/// most `_p50`, `_p99`, and `_p999` nanoseconds (`0` for no limit).
+#define su_expect_latency(_stmt, _reps, _p50, _p99, _p999) \
+    su_latency_impl(_stmt, _reps, _p50, _p99, _p999, false)
+#define su_assert_latency(_stmt, _reps, _p50, _p99, _p999) \
+    su_latency_impl(_stmt, _reps, _p50, _p99, _p999, true)
+
+/// Accepts a `su_output_t`, or a string (or `NULL`) the output must be equal to.
+#define su_output(_output) \
+    _Generic((_output), su_output_t: su__output_identity, default: su_output_equals)(_output)
+
 #define su_expect_exit(_stmt, _pred, _output)                                                 \
     do {                                                                                      \
         if (su__state.options.skip_death_tests) {                                             \
@@ -323,7 +1199,11 @@ void su_release_state(void);
                 _stmt;                                                                        \
             }                                                                                 \
             su_subproc_result_t su_result = su_subproc_end(su_info);                          \
-            if (su_check_subproc_result(&su_result, _pred, su_pretty_function(), __LINE__)) { \
+            const bool su_failed = su_check_subproc_result(                                   \
+                &su_result, _pred, su_output(_output), #_stmt, su_pretty_function(), __LINE__ \
+            );                                                                                \
+            su_subproc_result_drop(&su_result);                                               \
+            if (su_failed) {                                                                  \
                 su_self->status = SU_FAIL;                                                    \
                 return;                                                                       \
             }                                                                                 \
@@ -332,30 +1212,94 @@ void su_release_state(void);
 
 #define su_expect_death(_stmt, _output) su_expect_exit(_stmt, su_exited_abnormally(), _output)
 
+/// Like `su_expect_exit` but only starts the child, the result is checked by
+/// `su_await_death_tests`.
+#define su_expect_exit_async(_batch, _stmt, _pred, _output)                                     \
+    do {                                                                                        \
+        if (su__state.options.skip_death_tests) {                                               \
+            su_skip();                                                                          \
+        } else {                                                                                \
+            su_subproc_info_t su_info = su_subproc_begin();                                     \
+            if (su_info.pid == 0) {                                                             \
+                _stmt;                                                                          \
+                su_subproc_end(su_info);                                                        \
+            }                                                                                   \
+            su_subproc_batch_add(_batch, su_info, _pred, su_output(_output), #_stmt, __LINE__); \
+        }                                                                                       \
+    } while (0)
+
+#define su_expect_death_async(_batch, _stmt, _output) \
+    su_expect_exit_async(_batch, _stmt, su_exited_abnormally(), _output)
+
+#define su_await_death_tests(_batch)                                   \
+    do {                                                               \
+        if (su_subproc_batch_wait(_batch, su_pretty_function())) {     \
+            su_self->status = SU_FAIL;                                 \
+            return;                                                    \
+        }                                                              \
+    } while (0)
+
 #endif  // SMALLUNIT_H
 
 // MARK: - Implementation
 
 #ifdef SU_IMPLEMENTATION
 #include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fnmatch.h>
+#include <link.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
 
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
 static const char *SU_STATUS_LABELS[] = {
     "\x1b[32m:)\x1b[m",
     "\x1b[31m:(\x1b[m",
     "\x1b[33m:/\x1b[m",
+    "\x1b[35m:O\x1b[m",
 };
 
+static const char *SU_PLAIN_STATUS_LABELS[] = {":)", ":(", ":/", ":O"};
+
+static const char *SU_STATUS_NAMES[] = {"pass", "fail", "skip", "timeout"};
+
 su_state_t su__state;
+_Thread_local su_test_t *su__current_test;
 
 // MARK: - Time
 
 su_time_t
 su_time_from(struct timespec t) {
-    return (su_time_t){.value = t.tv_sec * 10000 + t.tv_nsec / 100000};
+    return (su_time_t){.value = (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec};
+}
+
+su_time_t
+su_time_now(clockid_t clock) {
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return su_time_from(t);
 }
 
 su_time_t
@@ -370,304 +1314,4889 @@ su_time_sub(su_time_t a, su_time_t b) {
 
 double
 su_time_ms(su_time_t t) {
-    return (double)t.value / 10.0;
+    return (double)t.value / 1e6;
 }
 
-// MARK: - Subprocesses
+// MARK: - Allocations
+
+// With `SU_TRACK_ALLOCS` the implementation defines `malloc` and friends on top of glibc's
+// `__libc_*` functions and counts the allocations of each test per thread.  Framework code that
+// runs during a test opens a `su_framework_allocs` scope, allocations inside it are not counted.
+
+#ifdef SU_TRACK_ALLOCS
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+
+static _Thread_local su_alloc_stats_t su__alloc_stats;
+static _Thread_local bool su__alloc_tracking;
+static _Thread_local unsigned su__alloc_paused;
 
 static void
-su_disable_core_dumps(void) {
-    struct rlimit rlim;
-    rlim.rlim_cur = 0;
-    rlim.rlim_max = 0;
-    if (setrlimit(RLIMIT_CORE, &rlim) == -1) {
-        perror("setrlimit");
-    }
+su_alloc_resume(int *_) {
+    (void)_;
+    --su__alloc_paused;
 }
 
-su_subproc_info_t
-su_subproc_begin(void) {
-    int p[2];
-    if (pipe(p) == -1) {
-        perror("pipe");
-        exit(1);
-    }
-    const int rx = p[0];
-    const int tx = p[1];
-    const int pid = fork();
-    switch (pid) {
-    case -1: perror("fork"); exit(1);
-
-    case 0:
-        su_disable_core_dumps();
-        dup2(tx, STDERR_FILENO);
-        close(rx);
-        break;
+#define su_framework_allocs() \
+    __attribute__((cleanup(su_alloc_resume), unused)) int su__alloc_scope = ++su__alloc_paused
 
-    default: close(tx); break;
+static inline void
+su_record_alloc(void *ptr) {
+    if (ptr && su__alloc_tracking && !su__alloc_paused) {
+        const size_t size = malloc_usable_size(ptr);
+        ++su__alloc_stats.allocs;
+        su__alloc_stats.bytes += size;
+        su__alloc_stats.live += size;
+        if (su__alloc_stats.live > su__alloc_stats.peak_live) {
+            su__alloc_stats.peak_live = su__alloc_stats.live;
+        }
     }
-    return (su_subproc_info_t){.pid = pid, .rx = rx, .tx = tx};
 }
 
-su_subproc_result_t
-su_subproc_end(su_subproc_info_t info) {
-    if (info.pid == 0) {
-        close(info.tx);
-        exit(EXIT_SUCCESS);
-    }
-    int status;
-    waitpid(info.pid, &status, 0);
-    char *const output = malloc(SU_STDERR_BUF_SIZE);
-    ssize_t n = read(info.rx, output, SU_STDERR_BUF_SIZE);
-    if (n == -1) {
-        perror("read");
-        exit(1);
-    }
-    close(info.rx);
-    output[n] = '\0';
-    while (n > 1 && isspace(output[n - 1])) {
-        output[--n] = '\0';
+static inline void
+su_record_free(void *ptr) {
+    if (ptr && su__alloc_tracking && !su__alloc_paused) {
+        ++su__alloc_stats.frees;
+        su__alloc_stats.live -= malloc_usable_size(ptr);
     }
-    const char *trimmed = output;
-    while (isspace(*trimmed)) {
-        ++trimmed;
-    }
-    return (su_subproc_result_t){
-        .status = status,
-        ._stderr_buf = output,
-        .standard_error = trimmed,
-    };
 }
 
-su_subproc_predicate_t
-su_exited_with_code(int code) {
-    return (su_subproc_predicate_t){.code_or_signal = code, .is_signal = false};
+void *
+malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+    su_record_alloc(ptr);
+    return ptr;
 }
 
-su_subproc_predicate_t
-su_killed_by_signal(int signal) {
-    return (su_subproc_predicate_t){.code_or_signal = signal, .is_signal = true};
+void *
+calloc(size_t count, size_t size) {
+    void *ptr = __libc_calloc(count, size);
+    su_record_alloc(ptr);
+    return ptr;
 }
 
-su_subproc_predicate_t
-su_exited_abnormally(void) {
-    return (su_subproc_predicate_t){.any_abnormal = true};
+void *
+realloc(void *ptr, size_t size) {
+    su_record_free(ptr);
+    void *result = __libc_realloc(ptr, size);
+    su_record_alloc(result);
+    return result;
 }
 
+void
+free(void *ptr) {
+    su_record_free(ptr);
+    __libc_free(ptr);
+}
+
+void *
+memalign(size_t alignment, size_t size) {
+    void *ptr = __libc_memalign(alignment, size);
+    su_record_alloc(ptr);
+    return ptr;
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int
+posix_memalign(void **result, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) || alignment & (alignment - 1)) {
+        return EINVAL;
+    }
+    *result = memalign(alignment, size);
+    return *result ? 0 : ENOMEM;
+}
+
+// `free` sees every allocation, so all of glibc's allocation functions are wrapped
+
+void *
+valloc(size_t size) {
+    void *ptr = __libc_valloc(size);
+    su_record_alloc(ptr);
+    return ptr;
+}
+
+void *
+pvalloc(size_t size) {
+    void *ptr = __libc_pvalloc(size);
+    su_record_alloc(ptr);
+    return ptr;
+}
+
+static void
+su_alloc_tracking_begin(void) {
+    su__alloc_stats = (su_alloc_stats_t){0};
+    su__alloc_paused = 0;
+    su__alloc_tracking = true;
+}
+
+static su_alloc_stats_t
+su_alloc_tracking_end(void) {
+    su__alloc_tracking = false;
+    // a timeout may have jumped out of a framework scope
+    su__alloc_paused = 0;
+    return su__alloc_stats;
+}
+
+static void
+su_alloc_stats_restore(su_alloc_stats_t stats) {
+    su__alloc_stats = stats;
+}
+
+su_alloc_stats_t
+su_alloc_stats(void) {
+    return su__alloc_stats;
+}
+
+#else
+#define su_framework_allocs() (void)0
+#define su_alloc_tracking_begin() (void)0
+#define su_alloc_tracking_end() ((su_alloc_stats_t){0})
+#define su_alloc_stats_restore(_stats) (void)(_stats)
+
+su_alloc_stats_t
+su_alloc_stats(void) {
+    return (su_alloc_stats_t){0};
+}
+#endif
+
 bool
-su_subproc_predicate_matches_status(su_subproc_predicate_t predicate, int status) {
-    if (predicate.any_abnormal) {
-        return WIFEXITED(status) && WEXITSTATUS(status) != 0;
-    } else if (predicate.is_signal) {
-        return WIFSIGNALED(status) && WTERMSIG(status) == predicate.code_or_signal;
+su_check_allocs(
+    su_alloc_stats_t before,
+    uint64_t max,
+    const char *stmt,
+    const char *test_name,
+    int line
+) {
+    const uint64_t allocs = su_alloc_stats().allocs - before.allocs;
+    if (allocs <= max) {
+        return false;
+    }
+    char value[32];
+    snprintf(value, sizeof(value), "%lu", (unsigned long)allocs);
+    if (!su_failure_novel(su_failure_count(line, stmt), value)) {
+        return true;
+    }
+    fprintf(
+        stderr,
+        "%s(%d): Assertion failed: at most %lu allocations in %s, got %lu\n",
+        test_name,
+        line,
+        (unsigned long)max,
+        stmt,
+        (unsigned long)allocs
+    );
+    return true;
+}
+
+// MARK: - Counters
+
+// Every thread opens its counters once, as a single group so they are scheduled together and
+// share one read.  Hardware counters that cannot be opened (the PMU may lack them or not be
+// virtualized at all) are left out, without any hardware counter the software ones are used.
+// Only user space is counted, which unprivileged processes are allowed to (with the default
+// `perf_event_paranoid`).  Benchmarks only count inside `su_bench_loop`.
+
+typedef struct {
+    uint32_t type;
+    uint64_t config;
+} su_counter_def_t;
+
+#define SU_CACHE_READ_MISS(_cache)                                                \
+    (PERF_COUNT_HW_CACHE_##_cache | PERF_COUNT_HW_CACHE_OP_READ << 8              \
+     | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static const su_counter_def_t SU_COUNTER_DEFS[SU_COUNTER_COUNT] = {
+    [SU_COUNTER_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [SU_COUNTER_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [SU_COUNTER_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [SU_COUNTER_L1D_MISSES] = {PERF_TYPE_HW_CACHE, SU_CACHE_READ_MISS(L1D)},
+    [SU_COUNTER_LLC_MISSES] = {PERF_TYPE_HW_CACHE, SU_CACHE_READ_MISS(LL)},
+    [SU_COUNTER_DTLB_MISSES] = {PERF_TYPE_HW_CACHE, SU_CACHE_READ_MISS(DTLB)},
+    [SU_COUNTER_TASK_CLOCK] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    [SU_COUNTER_PAGE_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static const char *const SU_COUNTER_NAMES[SU_COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "branch_misses",
+    "l1d_misses",
+    "llc_misses",
+    "dtlb_misses",
+    "task_clock_ns",
+    "page_faults",
+};
+
+/// Thread the counters were opened by, a forked worker inherits them but has to open its own.
+static _Thread_local pid_t su__counters_tid;
+static _Thread_local int su__counter_leader = -1;
+static _Thread_local int su__counter_fds[SU_COUNTER_COUNT];
+/// Counters opened successfully, in the order of the values of a group read.
+static _Thread_local uint32_t su__counter_mask;
+/// Set while a test is counted, benchmarks enable the counters around each sample.
+static _Thread_local bool su__counting;
+static _Thread_local uint64_t su__counter_iterations;
+
+static void
+su_counters_close(void) {
+    for (int i = 0; i < SU_COUNTER_COUNT; ++i) {
+        if (su__counter_mask & 1u << i) {
+            close(su__counter_fds[i]);
+        }
+    }
+    su__counter_mask = 0;
+    su__counter_leader = -1;
+    su__counters_tid = 0;
+}
+
+static bool
+su_counters_schedulable(void) {
+    if (su__counter_leader == -1) {
+        return true;
+    }
+    uint64_t group[3 + SU_COUNTER_COUNT];
+    ioctl(su__counter_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    // count something, so a scheduled group has a running time
+    (void)syscall(SYS_getppid);
+    ioctl(su__counter_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // `time_running` follows the number of values and `time_enabled`
+    return read(su__counter_leader, group, sizeof(group)) <= 0 || group[2] != 0;
+}
+
+/// Opens the counters in `[first, last)` that are available, returns `false` if there is none.
+static bool
+su_counters_open_group(int first, int last) {
+    for (int i = first; i < last; ++i) {
+        struct perf_event_attr attr = {
+            .type = SU_COUNTER_DEFS[i].type,
+            .size = sizeof(attr),
+            .config = SU_COUNTER_DEFS[i].config,
+            .disabled = su__counter_leader == -1,
+            .exclude_kernel = 1,
+            .exclude_hv = 1,
+            .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                         | PERF_FORMAT_TOTAL_TIME_RUNNING,
+        };
+        const int fd = (int)syscall(
+            SYS_perf_event_open, &attr, 0, -1, su__counter_leader, PERF_FLAG_FD_CLOEXEC
+        );
+        if (fd == -1) {
+            continue;
+        }
+        if (su__counter_leader == -1) {
+            su__counter_leader = fd;
+        }
+        su__counter_fds[i] = fd;
+        su__counter_mask |= 1u << i;
+    }
+    // a group needing more counters than the PMU has free is never scheduled, so drop members
+    // from the end until it is
+    for (int i = last - 1; i > first && !su_counters_schedulable(); --i) {
+        if (su__counter_mask & 1u << i && su__counter_fds[i] != su__counter_leader) {
+            close(su__counter_fds[i]);
+            su__counter_mask &= ~(1u << i);
+        }
+    }
+    return su__counter_leader != -1;
+}
+
+static bool
+su_counters_open(void) {
+    const pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (su__counters_tid == tid) {
+        return su__counter_leader != -1;
+    }
+    su_counters_close();
+    su__counters_tid = tid;
+    if (!su_counters_open_group(SU_COUNTER_CYCLES, SU_COUNTER_TASK_CLOCK)
+        && !su_counters_open_group(SU_COUNTER_TASK_CLOCK, SU_COUNTER_COUNT)) {
+        static atomic_flag warned = ATOMIC_FLAG_INIT;
+        if (!atomic_flag_test_and_set(&warned)) {
+            perror("perf_event_open");
+        }
+        return false;
+    }
+    return true;
+}
+
+static void
+su_counters_resume(void) {
+    if (su__counting) {
+        ioctl(su__counter_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static void
+su_counters_pause(void) {
+    if (su__counting) {
+        ioctl(su__counter_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static void
+su_counters_begin(const su_test_t *test) {
+    if (!su_counters_open()) {
+        return;
+    }
+    ioctl(su__counter_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    su__counting = true;
+    su__counter_iterations = 0;
+    if (!test->bench) {
+        su_counters_resume();
+    }
+}
+
+static su_counters_t
+su_counters_end(void) {
+    su_counters_t counters = {0};
+    if (!su__counting) {
+        return counters;
+    }
+    su_counters_pause();
+    su__counting = false;
+    struct {
+        uint64_t count;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t values[SU_COUNTER_COUNT];
+    } group;
+    const ssize_t n = read(su__counter_leader, &group, sizeof(group));
+    // a group that never got scheduled counted nothing
+    if (n < (ssize_t)offsetof(typeof(group), values) || !group.time_running) {
+        return counters;
+    }
+    const double scale = (double)group.time_enabled / group.time_running;
+    size_t next = 0;
+    for (int i = 0; i < SU_COUNTER_COUNT && next < group.count; ++i) {
+        if (su__counter_mask & 1u << i) {
+            counters.values[i] = (uint64_t)(group.values[next++] * scale);
+        }
+    }
+    counters.mask = su__counter_mask;
+    counters.iterations = su__counter_iterations;
+    return counters;
+}
+
+// MARK: - Timeouts
+
+// Each thread running tests with a timeout has a timer delivering SIGALRM to that thread, the
+// handler jumps back into `su_module_run_test` which kills the children of the test.  The test
+// may have been interrupted holding locks (of malloc, stdio, or its own) which are never released,
+// so the process is poisoned afterwards: workers hand the rest of their module to a new worker
+// and a run without workers or threads uses one as soon as any test has a timeout.
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static _Thread_local sigjmp_buf su__timeout_jmp;
+/// A test of this process timed out.
+static atomic_bool su__poisoned;
+/// Tests run on multiple threads of this process, which cannot be replaced after a timeout.
+static bool su__threaded;
+static _Thread_local volatile sig_atomic_t su__timeout_armed;
+static _Thread_local timer_t su__timer;
+static _Thread_local bool su__timer_created;
+/// Death test and fork fixture processes of the running test (stb array).
+static _Thread_local int *su__children;
+
+static void
+su_timeout_handler(int signal) {
+    (void)signal;
+    if (su__timeout_armed) {
+        su__timeout_armed = false;
+        siglongjmp(su__timeout_jmp, 1);
+    }
+}
+
+static void
+su_timeout_install(void) {
+    struct sigaction action = {.sa_handler = su_timeout_handler};
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGALRM, &action, NULL) == -1) {
+        perror("sigaction");
+    }
+}
+
+/// Starts the timer of this thread, `su__timeout_jmp` must be set.
+static void
+su_timeout_arm(uint32_t ms) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, su_timeout_install);
+    if (!su__timer_created) {
+        struct sigevent event = {.sigev_notify = SIGEV_THREAD_ID, .sigev_signo = SIGALRM};
+        event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+        if (timer_create(CLOCK_MONOTONIC, &event, &su__timer) == -1) {
+            perror("timer_create");
+            return;
+        }
+        su__timer_created = true;
+    }
+    const struct itimerspec spec = {
+        .it_value = {.tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000L},
+    };
+    su__timeout_armed = true;
+    timer_settime(su__timer, 0, &spec, NULL);
+}
+
+static void
+su_timeout_disarm(void) {
+    // a signal arriving after this is ignored by the handler
+    su__timeout_armed = false;
+    const struct itimerspec spec = {0};
+    timer_settime(su__timer, 0, &spec, NULL);
+}
+
+/// Frees the timer of this thread.
+static void
+su_timeout_release(void) {
+    if (su__timer_created) {
+        timer_delete(su__timer);
+        su__timer_created = false;
+    }
+    arrfree(su__children);
+}
+
+static void
+su_track_child(int pid) {
+    arrput(su__children, pid);
+}
+
+static void
+su_untrack_child(int pid) {
+    for (int i = 0; i < arrlen(su__children); ++i) {
+        if (su__children[i] == pid) {
+            const int last = arrpop(su__children);
+            if (i < arrlen(su__children)) {
+                su__children[i] = last;
+            }
+            return;
+        }
+    }
+}
+
+static void
+su_kill_children(void) {
+    for (int i = 0; i < arrlen(su__children); ++i) {
+        kill(su__children[i], SIGKILL);
+        while (waitpid(su__children[i], NULL, 0) == -1 && errno == EINTR) {
+        }
+    }
+    if (su__children) {
+        arrsetlen(su__children, 0);
+    }
+}
+
+// MARK: - Profiler
+
+// With `--profile` each thread running tests has another timer, counting the CPU time of that
+// thread and delivering SIGPROF to it.  The handler only stores the addresses of the interrupted
+// stack, they are symbolized and folded into `DIR/module.test.folded` once the test finished.
+// Frames are named after the function containing them, found in the symbol table of the object
+// (so static functions get names without `-rdynamic`, but not in stripped binaries), and stacks
+// start at the test function, leaving out the framework calling it.
+
+typedef struct {
+    int depth;
+    void *frames[SU_PROFILE_DEPTH];
+} su_profile_sample_t;
+
+/// The handler itself and the signal trampoline.
+#define SU_PROFILE_SKIP 2
+
+static _Thread_local su_profile_sample_t *su__profile_samples;
+static _Thread_local volatile sig_atomic_t su__profile_count;
+static _Thread_local volatile sig_atomic_t su__profile_dropped;
+static _Thread_local volatile sig_atomic_t su__profiling;
+static _Thread_local timer_t su__profile_timer;
+static _Thread_local bool su__profile_timer_created;
+
+static void
+su_profile_handler(int signal) {
+    (void)signal;
+    if (!su__profiling) {
+        return;
+    }
+    const int saved_errno = errno;
+    if (su__profile_count < SU_PROFILE_SAMPLES) {
+        su_profile_sample_t *sample = &su__profile_samples[su__profile_count];
+        sample->depth = backtrace(sample->frames, SU_PROFILE_DEPTH);
+        ++su__profile_count;
     } else {
-        return WIFEXITED(status) && WEXITSTATUS(status) == predicate.code_or_signal;
+        ++su__profile_dropped;
+    }
+    errno = saved_errno;
+}
+
+static void
+su_profile_install(void) {
+    // the first call loads the unwinder, which allocates and cannot happen inside the handler
+    void *frame;
+    backtrace(&frame, 1);
+    struct sigaction action = {.sa_handler = su_profile_handler, .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    // a timeout must not jump out of the unwinder while it holds a lock
+    sigaddset(&action.sa_mask, SIGALRM);
+    if (sigaction(SIGPROF, &action, NULL) == -1) {
+        perror("sigaction");
+    }
+}
+
+/// Starts sampling this thread.
+static void
+su_profile_begin(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, su_profile_install);
+    su__profile_count = 0;
+    su__profile_dropped = 0;
+    if (!su__profile_samples) {
+        su__profile_samples = malloc(SU_PROFILE_SAMPLES * sizeof(*su__profile_samples));
+        if (!su__profile_samples) {
+            perror("malloc");
+            return;
+        }
+    }
+    if (!su__profile_timer_created) {
+        struct sigevent event = {.sigev_notify = SIGEV_THREAD_ID, .sigev_signo = SIGPROF};
+        event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &su__profile_timer) == -1) {
+            perror("timer_create");
+            return;
+        }
+        su__profile_timer_created = true;
+    }
+    const struct timespec interval = {.tv_nsec = 1000000000L / SU_PROFILE_HZ};
+    su__profiling = true;
+    timer_settime(su__profile_timer, 0, &(struct itimerspec){interval, interval}, NULL);
+}
+
+static void
+su_profile_end(void) {
+    if (su__profiling) {
+        su__profiling = false;
+        timer_settime(su__profile_timer, 0, &(struct itimerspec){0}, NULL);
+    }
+}
+
+/// Frees the timer and samples of this thread.
+static void
+su_profile_release(void) {
+    if (su__profile_timer_created) {
+        timer_delete(su__profile_timer);
+        su__profile_timer_created = false;
+    }
+    free(su__profile_samples);
+    su__profile_samples = NULL;
+}
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    /// Points into the mapped file.
+    const char *name;
+} su_profile_function_t;
+
+/// Function symbols of a loaded object.
+typedef struct {
+    /// `dli_fbase` of the object.
+    uintptr_t base;
+    void *map;
+    size_t map_size;
+    /// Sorted by address (stb array), empty if the file could not be read.
+    su_profile_function_t *functions;
+} su_profile_object_t;
+
+/// Objects read so far, shared by all threads (stb array).
+static su_profile_object_t *su__profile_objects;
+static pthread_mutex_t su__profile_objects_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+su_compare_functions(const void *a, const void *b) {
+    const su_profile_function_t *x = a;
+    const su_profile_function_t *y = b;
+    // aliases share an address, the name makes the pick deterministic
+    return x->start != y->start ? (x->start > y->start) - (x->start < y->start)
+                                : strcmp(x->name, y->name);
+}
+
+/// Reads the functions of `.symtab`, or `.dynsym` if the object is stripped.
+static void
+su_profile_read_symbols(su_profile_object_t *object, const char *path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ElfW(Ehdr))) {
+        object->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        object->map_size = st.st_size;
+    }
+    close(fd);
+    if (!object->map || object->map == MAP_FAILED) {
+        object->map = NULL;
+        return;
+    }
+    const char *file = object->map;
+    const size_t size = object->map_size;
+    const ElfW(Ehdr) *header = object->map;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0
+        || header->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32)
+        || header->e_shentsize != sizeof(ElfW(Shdr))
+        || header->e_shoff + (size_t)header->e_shnum * sizeof(ElfW(Shdr)) > size) {
+        return;
+    }
+    const ElfW(Shdr) *sections = (const ElfW(Shdr) *)(file + header->e_shoff);
+    const ElfW(Shdr) *table = NULL;
+    for (int i = 0; i < header->e_shnum; ++i) {
+        if (sections[i].sh_type == SHT_SYMTAB
+            || (sections[i].sh_type == SHT_DYNSYM && !table)) {
+            table = &sections[i];
+        }
+    }
+    if (!table || table->sh_link >= header->e_shnum || table->sh_offset + table->sh_size > size) {
+        return;
+    }
+    const ElfW(Shdr) *strings = &sections[table->sh_link];
+    if (strings->sh_offset + strings->sh_size > size || !strings->sh_size) {
+        return;
+    }
+    // shared objects and position independent executables are linked at 0
+    const uintptr_t bias = header->e_type == ET_DYN ? object->base : 0;
+    // PLT stubs have no symbols, they are named after their section
+    const ElfW(Shdr) *names = &sections[header->e_shstrndx];
+    if (header->e_shstrndx >= header->e_shnum || names->sh_offset + names->sh_size > size) {
+        names = NULL;
+    }
+    for (int i = 0; names && i < header->e_shnum; ++i) {
+        const char *section = file + names->sh_offset + sections[i].sh_name;
+        if (sections[i].sh_name < names->sh_size && (sections[i].sh_flags & SHF_EXECINSTR)
+            && strncmp(section, ".plt", 4) == 0) {
+            const su_profile_function_t function = {
+                .start = bias + sections[i].sh_addr,
+                .end = bias + sections[i].sh_addr + sections[i].sh_size,
+                .name = section,
+            };
+            arrput(object->functions, function);
+        }
+    }
+    const ElfW(Sym) *symbols = (const ElfW(Sym) *)(file + table->sh_offset);
+    for (size_t i = 0; i < table->sh_size / sizeof(*symbols); ++i) {
+        const ElfW(Sym) *symbol = &symbols[i];
+        const int type = ELF64_ST_TYPE(symbol->st_info);
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) || symbol->st_shndx == SHN_UNDEF
+            || !symbol->st_value || symbol->st_name >= strings->sh_size) {
+            continue;
+        }
+        const su_profile_function_t function = {
+            .start = bias + symbol->st_value,
+            .end = bias + symbol->st_value + symbol->st_size,
+            .name = file + strings->sh_offset + symbol->st_name,
+        };
+        arrput(object->functions, function);
+    }
+    if (object->functions) {
+        qsort(
+            object->functions, arrlen(object->functions), sizeof(*object->functions),
+            su_compare_functions
+        );
+    }
+}
+
+/// Function of the object at `info` containing `pc`.
+static const su_profile_function_t *
+su_profile_find_function(const Dl_info *info, uintptr_t pc) {
+    pthread_mutex_lock(&su__profile_objects_lock);
+    su_profile_object_t *object = NULL;
+    for (int i = 0; i < arrlen(su__profile_objects); ++i) {
+        if (su__profile_objects[i].base == (uintptr_t)info->dli_fbase) {
+            object = &su__profile_objects[i];
+        }
+    }
+    if (!object) {
+        object = su_arrpush(su__profile_objects);
+        *object = (su_profile_object_t){.base = (uintptr_t)info->dli_fbase};
+        // dladdr names the executable by `argv[0]`, which is relative to the starting directory
+        const bool executable = su_streq(info->dli_fname, program_invocation_name);
+        su_profile_read_symbols(object, executable ? "/proc/self/exe" : info->dli_fname);
+    }
+    const su_profile_function_t *functions = object->functions;
+    pthread_mutex_unlock(&su__profile_objects_lock);
+    // the last function starting at or before `pc`
+    size_t lo = 0;
+    size_t hi = arrlen(functions);
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (functions[mid].start <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo && pc < functions[lo - 1].end ? &functions[lo - 1] : NULL;
+}
+
+/// Unmaps the objects read for symbolizing.
+static void
+su_profile_free_symbols(void) {
+    for (int i = 0; i < arrlen(su__profile_objects); ++i) {
+        if (su__profile_objects[i].map) {
+            munmap(su__profile_objects[i].map, su__profile_objects[i].map_size);
+        }
+        arrfree(su__profile_objects[i].functions);
+    }
+    arrfree(su__profile_objects);
+}
+
+static int
+su_compare_pointers(const void *a, const void *b) {
+    const uintptr_t x = *(const uintptr_t *)a;
+    const uintptr_t y = *(const uintptr_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int
+su_compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/// Name and start of the function containing `address - 1`, without a symbol the name of the
+/// object, or the address if it is not part of one.
+static char *
+su_profile_symbol(void *address, uintptr_t *start) {
+    char *name = NULL;
+    Dl_info info;
+    // return addresses may point just past the end of the calling function
+    const uintptr_t pc = (uintptr_t)address - 1;
+    *start = pc;
+    if (!dladdr((void *)pc, &info) || !info.dli_fname) {
+        asprintf(&name, "0x%lx", (unsigned long)pc);
+        return name;
+    }
+    const su_profile_function_t *function = su_profile_find_function(&info, pc);
+    if (function) {
+        *start = function->start;
+        name = strdup(function->name);
+    } else if (info.dli_sname) {
+        *start = (uintptr_t)info.dli_saddr;
+        name = strdup(info.dli_sname);
+    } else {
+        const char *object = strrchr(info.dli_fname, '/');
+        *start = (uintptr_t)info.dli_fbase;
+        name = strdup(object ? object + 1 : info.dli_fname);
+    }
+    return name;
+}
+
+static void
+su_profile_append(char **line, const char *string) {
+    const size_t length = strlen(string);
+    memcpy(arraddnptr(*line, length), string, length);
+}
+
+static void su_module_run_test_body(su_module_t *mod, void *object, su_test_t *test);
+static void su_module_run_test_with_timeout(
+    su_module_t *mod, void *object, su_test_t *test, uint32_t ms
+);
+static void su_bench_run(su_module_t *mod, void *object, su_test_t *test);
+
+/// Index one past the outermost frame of `sample` belonging to `test`: the test function, or
+/// the frame before the framework code calling it if the test function made a tail call.
+static int
+su_profile_test_frames(
+    const su_profile_sample_t *sample,
+    const su_test_t *test,
+    void **addresses,
+    const uintptr_t *starts,
+    size_t unique
+) {
+    const uintptr_t callers[] = {
+        (uintptr_t)test->module->vtable->run,
+        (uintptr_t)su_bench_run,
+        (uintptr_t)su_module_run_test_body,
+        (uintptr_t)su_module_run_test_with_timeout,
+        (uintptr_t)su_module_run_test,
+    };
+    for (int i = SU_PROFILE_SKIP; i < sample->depth; ++i) {
+        void **found = bsearch(
+            &sample->frames[i], addresses, unique, sizeof(*addresses), su_compare_pointers
+        );
+        const uintptr_t start = starts[found - addresses];
+        if (start == (uintptr_t)test->fn) {
+            return i + 1;
+        }
+        for (size_t j = 0; j < sizeof(callers) / sizeof(*callers); ++j) {
+            if (start == callers[j]) {
+                return i;
+            }
+        }
+    }
+    // a truncated stack keeps all of its frames
+    return sample->depth;
+}
+
+/// Writes the samples of the last test as `module.test;outer;...;inner count` lines.
+static void
+su_profile_write(const char *dir, const su_test_t *test) {
+    const char *name = test->pretty_name;
+    const int count = su__profile_count;
+    if (su__profile_dropped) {
+        fprintf(stderr, "%s: %d profile samples dropped\n", name, (int)su__profile_dropped);
+    }
+    if (!count) {
+        return;
+    }
+    // the interrupted frame is the exact instruction rather than a return address
+    for (int i = 0; i < count; ++i) {
+        su_profile_sample_t *sample = &su__profile_samples[i];
+        if (sample->depth > SU_PROFILE_SKIP) {
+            sample->frames[SU_PROFILE_SKIP] = (char *)sample->frames[SU_PROFILE_SKIP] + 1;
+        }
+    }
+    void **addresses = NULL;
+    for (int i = 0; i < count; ++i) {
+        const su_profile_sample_t *sample = &su__profile_samples[i];
+        for (int j = SU_PROFILE_SKIP; j < sample->depth; ++j) {
+            arrput(addresses, sample->frames[j]);
+        }
+    }
+    size_t unique = 0;
+    if (addresses) {
+        qsort(addresses, arrlen(addresses), sizeof(*addresses), su_compare_pointers);
+        for (int i = 0; i < arrlen(addresses); ++i) {
+            if (!unique || addresses[i] != addresses[unique - 1]) {
+                addresses[unique++] = addresses[i];
+            }
+        }
+    }
+    char **symbols = malloc((unique ? unique : 1) * sizeof(*symbols));
+    uintptr_t *starts = malloc((unique ? unique : 1) * sizeof(*starts));
+    for (size_t i = 0; i < unique; ++i) {
+        symbols[i] = su_profile_symbol(addresses[i], &starts[i]);
+    }
+    char **lines = NULL;
+    for (int i = 0; i < count; ++i) {
+        const su_profile_sample_t *sample = &su__profile_samples[i];
+        char *line = NULL;
+        su_profile_append(&line, name);
+        const int end = su_profile_test_frames(sample, test, addresses, starts, unique);
+        for (int j = end - 1; j >= SU_PROFILE_SKIP; --j) {
+            void **found = bsearch(
+                &sample->frames[j], addresses, unique, sizeof(*addresses), su_compare_pointers
+            );
+            arrput(line, ';');
+            su_profile_append(&line, symbols[found - addresses]);
+        }
+        arrput(line, '\0');
+        arrput(lines, line);
+    }
+    qsort(lines, count, sizeof(*lines), su_compare_strings);
+    char *path;
+    FILE *file = NULL;
+    if (asprintf(&path, "%s/%s.folded", dir, name) != -1) {
+        file = fopen(path, "w");
+        if (!file) {
+            perror(path);
+        }
+        free(path);
+    }
+    for (int i = 0, run = 1; file && i < count; ++i, ++run) {
+        if (i + 1 == count || !su_streq(lines[i], lines[i + 1])) {
+            fprintf(file, "%s %d\n", lines[i], run);
+            run = 0;
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+    for (int i = 0; i < count; ++i) {
+        arrfree(lines[i]);
+    }
+    for (size_t i = 0; i < unique; ++i) {
+        free(symbols[i]);
+    }
+    arrfree(lines);
+    free(symbols);
+    free(starts);
+    arrfree(addresses);
+}
+
+// MARK: - Failures
+
+// An assertion failing inside a loop would print its message on every iteration, so failures
+// are counted per assertion (its line and text) of the test instead.  Only the first ones (with
+// distinct values) are printed, the number of the others once the test finished.
+
+su_failure_t *
+su_failure_count(int line, const char *expr) {
+    su_test_t *test = su__current_test;
+    if (!test) {
+        return NULL;
+    }
+    for (int i = 0; i < arrlen(test->failures); ++i) {
+        if (test->failures[i].line == line && test->failures[i].expr == expr) {
+            ++test->failures[i].count;
+            return &test->failures[i];
+        }
+    }
+    su_framework_allocs();
+    su_failure_t *failure = su_arrpush(test->failures);
+    *failure = (su_failure_t){.line = line, .expr = expr, .count = 1};
+    return failure;
+}
+
+bool
+su_failure_novel(su_failure_t *failure, const char *value) {
+    if (!failure) {
+        return true;
+    } else if (failure->full) {
+        return false;
+    } else if (!value) {
+        failure->full = true;
+        return true;
+    }
+    for (int i = 0; i < arrlen(failure->values); ++i) {
+        if (su_streq(failure->values[i], value)) {
+            return false;
+        }
+    }
+    su_framework_allocs();
+    arrput(failure->values, strdup(value));
+    failure->full = arrlen(failure->values) >= SU_FAILURE_VALUES;
+    return true;
+}
+
+/// Prints how often the assertions of the test failed beyond what was printed, and forgets
+/// the failures.
+static void
+su_failure_summary(su_test_t *test) {
+    su_framework_allocs();
+    for (int i = 0; i < arrlen(test->failures); ++i) {
+        su_failure_t *failure = &test->failures[i];
+        const uint64_t shown = arrlen(failure->values) ? arrlen(failure->values) : 1;
+        if (failure->count > shown) {
+            fprintf(
+                stderr,
+                "%s(%d): failed %lu times, %lu not shown\n",
+                test->pretty_name,
+                failure->line,
+                (unsigned long)failure->count,
+                (unsigned long)(failure->count - shown)
+            );
+        }
+        for (int j = 0; j < arrlen(failure->values); ++j) {
+            free(failure->values[j]);
+        }
+        arrfree(failure->values);
+    }
+    arrfree(test->failures);
+}
+
+// MARK: - Escaping
+
+// Names of modules and tests are identifiers, but those of benchmark counters and the output of
+// tests can be anything, so all strings of the reports and the trace go through these.
+
+/// Writes `string` as the contents of a JSON string.
+static void
+su_json_escape(FILE *out, const char *string) {
+    for (const unsigned char *c = (const unsigned char *)string; *c; ++c) {
+        switch (*c) {
+        case '"': fputs("\\\"", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '\n': fputs("\\n", out); break;
+        case '\t': fputs("\\t", out); break;
+        default:
+            if (*c < 0x20) {
+                fprintf(out, "\\u%04x", *c);
+            } else {
+                fputc(*c, out);
+            }
+        }
+    }
+}
+
+/// `su_json_escape` into a new string.
+static char *
+su_json_escaped(const char *string) {
+    char *escaped = NULL;
+    size_t size;
+    FILE *out = open_memstream(&escaped, &size);
+    if (out) {
+        su_json_escape(out, string);
+        fclose(out);
+    }
+    return escaped;
+}
+
+/// Whether XML 1.0 allows the character at all.
+static bool
+su_xml_char(unsigned char c) {
+    return c >= 0x20 || c == '\t' || c == '\n' || c == '\r';
+}
+
+/// Writes the first `length` bytes of `string` as XML text or attribute value.
+static void
+su_xml_escape(FILE *out, const char *string, size_t length) {
+    for (size_t i = 0; i < length && string[i]; ++i) {
+        const unsigned char c = string[i];
+        switch (c) {
+        case '&': fputs("&amp;", out); break;
+        case '<': fputs("&lt;", out); break;
+        case '>': fputs("&gt;", out); break;
+        case '"': fputs("&quot;", out); break;
+        case '\'': fputs("&apos;", out); break;
+        default:
+            if (su_xml_char(c)) {
+                fputc(c, out);
+            }
+        }
+    }
+}
+
+/// Writes `string` as a CDATA section, splitting it around any `]]>`.
+static void
+su_xml_cdata(FILE *out, const char *string) {
+    fputs("<![CDATA[", out);
+    for (const char *c = string; *c; ++c) {
+        if (strncmp(c, "]]>", 3) == 0) {
+            fputs("]]]]><![CDATA[>", out);
+            c += 2;
+        } else if (su_xml_char(*c)) {
+            fputc(*c, out);
+        }
+    }
+    fputs("]]>", out);
+}
+
+// MARK: - Trace
+
+// With `--trace` every process appends its spans to the trace file as complete events of the
+// Chrome trace event format.  Each event is a single `write` to the `O_APPEND` file, so events of
+// workers and threads never interleave; the closing bracket is written once all of them finished
+// (viewers accept the file without it too).
+
+static int su__trace_fd = -1;
+
+static void
+su_trace_write(const char *event, int size) {
+    if (write(su__trace_fd, event, size) != size) {
+        static atomic_flag warned = ATOMIC_FLAG_INIT;
+        if (!atomic_flag_test_and_set(&warned)) {
+            perror("trace");
+        }
+    }
+}
+
+static void
+su_trace_open(const char *path) {
+    su__trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+    if (su__trace_fd == -1) {
+        perror(path);
+        return;
+    }
+    char event[128];
+    const int n = snprintf(
+        event, sizeof(event), "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"main\"}}", (int)getpid()
+    );
+    su_trace_write(event, n);
+}
+
+static void
+su_trace_close(void) {
+    if (su__trace_fd != -1) {
+        su_trace_write("\n]\n", 3);
+        close(su__trace_fd);
+        su__trace_fd = -1;
+    }
+}
+
+/// Names the calling process (`kind` is `"process_name"`) or thread (`"thread_name"`).
+static void
+su_trace_name(const char *kind, const char *name, size_t index) {
+    if (su__trace_fd == -1) {
+        return;
+    }
+    char event[192];
+    const int n = snprintf(
+        event, sizeof(event),
+        ",\n{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %zu\"}}",
+        kind, (int)getpid(), (int)syscall(SYS_gettid), name, index
+    );
+    su_trace_write(event, n);
+}
+
+/// Start of a span, only read when tracing.
+static su_time_t
+su_trace_now(void) {
+    return su__trace_fd == -1 ? (su_time_t){0} : su_time_now(CLOCK_MONOTONIC);
+}
+
+/// Appends a span of this thread, `args` are the members of its `args` object or `NULL`.
+static void
+su_trace_span(
+    const char *category, const char *name, su_time_t start, su_time_t end, const char *args
+) {
+    if (su__trace_fd == -1) {
+        return;
+    }
+    su_framework_allocs();
+    const uint64_t ts = start.value;
+    const uint64_t dur = end.value - start.value;
+    char *escaped = su_json_escaped(name);
+    char *event;
+    // timestamps are in microseconds, the fraction keeps the nanoseconds
+    const int n = asprintf(
+        &event,
+        ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lu.%03lu,\"dur\":%lu.%03lu,"
+        "\"pid\":%d,\"tid\":%d,\"args\":{%s}}",
+        escaped ? escaped : "", category, (unsigned long)(ts / 1000), (unsigned long)(ts % 1000),
+        (unsigned long)(dur / 1000), (unsigned long)(dur % 1000), (int)getpid(),
+        (int)syscall(SYS_gettid), args ? args : ""
+    );
+    if (n != -1) {
+        su_trace_write(event, n);
+        free(event);
+    }
+    free(escaped);
+}
+
+/// Appends a span from `start` to now.
+static void
+su_trace_end(const char *category, const char *name, su_time_t start, const char *args) {
+    if (su__trace_fd != -1) {
+        su_trace_span(category, name, start, su_time_now(CLOCK_MONOTONIC), args);
+    }
+}
+
+/// Appends a span of fixture code of `mod`.
+static void
+su_trace_fixture(const char *name, const su_module_t *mod, su_time_t start) {
+    if (su__trace_fd != -1) {
+        char *module = su_json_escaped(mod->name);
+        char args[256];
+        snprintf(args, sizeof(args), "\"module\":\"%s\"", module ? module : "");
+        su_trace_end("fixture", name, start, args);
+        free(module);
+    }
+}
+
+/// Appends the span of a child process forked at `start`.
+static void
+su_trace_child(const char *name, int pid, su_time_t start) {
+    if (su__trace_fd != -1) {
+        char args[32];
+        snprintf(args, sizeof(args), "\"pid\":%d", pid);
+        su_trace_end("subprocess", name, start, args);
+    }
+}
+
+// MARK: - Subprocesses
+
+static bool
+su_write_all(int fd, const void *buf, size_t size) {
+    const char *p = buf;
+    while (size) {
+        const ssize_t n = write(fd, p, size);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool
+su_read_all(int fd, void *buf, size_t size) {
+    char *p = buf;
+    while (size) {
+        const ssize_t n = read(fd, p, size);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void
+su_disable_core_dumps(void) {
+    struct rlimit rlim;
+    rlim.rlim_cur = 0;
+    rlim.rlim_max = 0;
+    if (setrlimit(RLIMIT_CORE, &rlim) == -1) {
+        perror("setrlimit");
+    }
+}
+
+static void
+su_pipe(int *rx, int *tx) {
+    int p[2];
+    if (pipe(p) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    *rx = p[0];
+    *tx = p[1];
+}
+
+// A test that times out jumps out of the death tests it waits for, and its stack is gone
+// afterwards.  Their pipes and output are therefore also kept here until they are closed, so
+// `su_subproc_release` can clean up after the jump.
+
+/// Pipes and output of the death test started by `su_subproc_begin`, `-1` and `NULL` if none.
+static _Thread_local int su__subproc_fds[2] = {-1, -1};
+static _Thread_local char *su__subproc_bufs[2];
+
+/// The epoll descriptor and children of a batch of the running test.
+typedef struct {
+    int epoll_fd;
+    su_subproc_pending_t *pending;
+} su_batch_resources_t;
+
+/// Batches of the running test not waited for yet (stb array).
+static _Thread_local su_batch_resources_t *su__batches;
+
+su_subproc_info_t
+su_subproc_begin(void) {
+    // the child would otherwise flush our pending output (including the report) a second time
+    fflush(NULL);
+    su_subproc_info_t info = {.start = su_trace_now()};
+    su_pipe(&info.rx, &info.tx);
+    su_pipe(&info.out_rx, &info.out_tx);
+    info.pid = fork();
+    switch (info.pid) {
+    case -1: perror("fork"); exit(1);
+
+    case 0:
+        // the timeout of the test is enforced by the parent, the counters count the parent
+        su__timeout_armed = false;
+        su__counting = false;
+        su_disable_core_dumps();
+        dup2(info.tx, STDERR_FILENO);
+        dup2(info.out_tx, STDOUT_FILENO);
+        close(info.rx);
+        close(info.out_rx);
+        break;
+
+    default:
+        close(info.tx);
+        close(info.out_tx);
+        su__subproc_fds[0] = info.rx;
+        su__subproc_fds[1] = info.out_rx;
+        su_framework_allocs();
+        su_track_child(info.pid);
+        break;
+    }
+    return info;
+}
+
+/// Reads what is available from `fd` into the stb array `*buf`, returns `false` at EOF.
+static bool
+su_drain_fd(int fd, char **buf) {
+    // most children print nothing, so the buffer is only allocated once there is output
+    char chunk[256];
+    char *dst = chunk;
+    size_t space = sizeof(chunk);
+    const size_t len = arrlen(*buf);
+    if (*buf) {
+        if (arrcap(*buf) - len < 2) {
+            arrsetcap(*buf, arrcap(*buf) * 2);
+        }
+        dst = *buf + len;
+        space = arrcap(*buf) - len - 1;
+    }
+    const ssize_t n = read(fd, dst, space);
+    if (n == -1) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return true;
+        }
+        perror("read");
+        return false;
+    }
+    if (n > 0) {
+        if (!*buf) {
+            arrsetcap(*buf, SU_STDERR_BUF_SIZE);
+            memcpy(*buf, chunk, n);
+        }
+        arrsetlen(*buf, len + n);
+    }
+    return n != 0;
+}
+
+static const char *
+su_trim_output(char **buf) {
+    // the array always has room for the terminator, see `su_drain_fd`
+    arrsetcap(*buf, arrlen(*buf) + 1);
+    char *s = *buf;
+    size_t n = arrlen(s);
+    s[n] = '\0';
+    while (n && isspace((unsigned char)s[n - 1])) {
+        s[--n] = '\0';
+    }
+    while (isspace((unsigned char)*s)) {
+        ++s;
+    }
+    return s;
+}
+
+su_subproc_result_t
+su_subproc_end(su_subproc_info_t info) {
+    if (info.pid == 0) {
+        close(info.tx);
+        close(info.out_tx);
+        exit(EXIT_SUCCESS);
+    }
+    su_framework_allocs();
+    su_subproc_result_t result = {0};
+    // drain both pipes until the child closes them, waiting first would deadlock as soon as
+    // the child fills a pipe
+    struct pollfd fds[] = {
+        {.fd = info.rx, .events = POLLIN},
+        {.fd = info.out_rx, .events = POLLIN},
+    };
+    char **bufs[] = {&su__subproc_bufs[0], &su__subproc_bufs[1]};
+    int open = 2;
+    while (open) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd != -1 && fds[i].revents && !su_drain_fd(fds[i].fd, bufs[i])) {
+                close(fds[i].fd);
+                fds[i].fd = su__subproc_fds[i] = -1;
+                --open;
+            }
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (fds[i].fd != -1) {
+            close(fds[i].fd);
+            su__subproc_fds[i] = -1;
+        }
+    }
+    while (waitpid(info.pid, &result.status, 0) == -1 && errno == EINTR) {
+    }
+    su_untrack_child(info.pid);
+    su_trace_child("death test", info.pid, info.start);
+    result._stderr_buf = su__subproc_bufs[0];
+    result._stdout_buf = su__subproc_bufs[1];
+    su__subproc_bufs[0] = su__subproc_bufs[1] = NULL;
+    result.standard_error = su_trim_output(&result._stderr_buf);
+    result.standard_output = su_trim_output(&result._stdout_buf);
+    return result;
+}
+
+void
+su_subproc_result_drop(su_subproc_result_t *result) {
+    su_framework_allocs();
+    arrfree(result->_stderr_buf);
+    arrfree(result->_stdout_buf);
+    result->standard_error = NULL;
+    result->standard_output = NULL;
+}
+
+su_output_t
+su_output_equals(const char *text) {
+    return (su_output_t){.kind = SU_OUTPUT_EQUALS, .pattern = text};
+}
+
+su_output_t
+su_output_prefix(const char *prefix) {
+    return (su_output_t){.kind = SU_OUTPUT_PREFIX, .pattern = prefix};
+}
+
+su_output_t
+su_output_contains(const char *text) {
+    return (su_output_t){.kind = SU_OUTPUT_CONTAINS, .pattern = text};
+}
+
+su_output_t
+su_output_regex(const char *regex) {
+    return (su_output_t){.kind = SU_OUTPUT_REGEX, .pattern = regex};
+}
+
+su_output_t
+su_on_stdout(su_output_t output) {
+    output.standard_output = true;
+    return output;
+}
+
+su_output_t
+su__output_identity(su_output_t output) {
+    return output;
+}
+
+/// A compiled `SU_OUTPUT_REGEX` pattern.
+typedef struct {
+    char *pattern;
+    regex_t *re;
+} su_regex_entry_t;
+
+/// Patterns compiled by this thread (stb array), a death test in a loop compiles its pattern
+/// only once.
+static _Thread_local su_regex_entry_t *su__regexes;
+
+/// Returns the compiled `pattern`, or `NULL` after printing why it is invalid.
+static const regex_t *
+su_regex_compile(const char *pattern) {
+    for (int i = 0; i < arrlen(su__regexes); ++i) {
+        if (su_streq(su__regexes[i].pattern, pattern)) {
+            return su__regexes[i].re;
+        }
+    }
+    su_framework_allocs();
+    regex_t *re = malloc(sizeof(*re));
+    const int error = regcomp(re, pattern, REG_EXTENDED | REG_NOSUB);
+    if (error) {
+        char message[256];
+        regerror(error, re, message, sizeof(message));
+        printf("invalid regex \"%s\": %s\n", pattern, message);
+        free(re);
+        return NULL;
+    }
+    arrput(su__regexes, ((su_regex_entry_t){.pattern = strdup(pattern), .re = re}));
+    return re;
+}
+
+/// Frees the patterns compiled by this thread.
+static void
+su_regex_release(void) {
+    for (int i = 0; i < arrlen(su__regexes); ++i) {
+        free(su__regexes[i].pattern);
+        regfree(su__regexes[i].re);
+        free(su__regexes[i].re);
+    }
+    arrfree(su__regexes);
+}
+
+bool
+su_output_matches(su_output_t output, const char *text) {
+    if (!output.pattern) {
+        return true;
+    }
+    switch (output.kind) {
+    case SU_OUTPUT_EQUALS: return strcmp(text, output.pattern) == 0;
+    case SU_OUTPUT_PREFIX: return strncmp(text, output.pattern, strlen(output.pattern)) == 0;
+    case SU_OUTPUT_CONTAINS: return strstr(text, output.pattern) != NULL;
+    case SU_OUTPUT_REGEX: {
+        const regex_t *re = su_regex_compile(output.pattern);
+        return re && regexec(re, text, 0, NULL, 0) == 0;
+    }
+    }
+    return false;
+}
+
+static void
+su_print_output_expectation(su_output_t output, const char *got) {
+    static const char *const DESCRIPTIONS[] = {
+        [SU_OUTPUT_EQUALS] = "",
+        [SU_OUTPUT_PREFIX] = "starting with ",
+        [SU_OUTPUT_CONTAINS] = "containing ",
+        [SU_OUTPUT_REGEX] = "matching ",
+    };
+    // heavy output is cut off, the test only needs enough to see what went wrong
+    const int limit = 1024;
+    const int len = (int)strlen(got);
+    printf(
+        "%s %s\"%s\", got \"%.*s%s\"\n",
+        output.standard_output ? "stdout" : "output",
+        DESCRIPTIONS[output.kind],
+        output.pattern,
+        len > limit ? limit : len,
+        got,
+        len > limit ? "..." : ""
+    );
+}
+
+su_subproc_predicate_t
+su_exited_with_code(int code) {
+    return (su_subproc_predicate_t){.code_or_signal = code, .is_signal = false};
+}
+
+su_subproc_predicate_t
+su_killed_by_signal(int signal) {
+    return (su_subproc_predicate_t){.code_or_signal = signal, .is_signal = true};
+}
+
+su_subproc_predicate_t
+su_exited_abnormally(void) {
+    return (su_subproc_predicate_t){.any_abnormal = true};
+}
+
+bool
+su_subproc_predicate_matches_status(su_subproc_predicate_t predicate, int status) {
+    if (predicate.any_abnormal) {
+        return WIFEXITED(status) && WEXITSTATUS(status) != 0;
+    } else if (predicate.is_signal) {
+        return WIFSIGNALED(status) && WTERMSIG(status) == predicate.code_or_signal;
+    } else {
+        return WIFEXITED(status) && WEXITSTATUS(status) == predicate.code_or_signal;
+    }
+}
+
+static const char *
+su_describe_status(int status, char *buf, size_t size) {
+    if (WIFEXITED(status)) {
+        const int code = WEXITSTATUS(status);
+        if (code == 0) {
+            return "exited normally";
+        }
+        snprintf(buf, size, "code(%d)", code);
+    } else if (WIFSIGNALED(status)) {
+        snprintf(buf, size, "signal(%d)", WTERMSIG(status));
+    } else {
+        return "unknown";
+    }
+    return buf;
+}
+
+bool
+su_check_subproc_result(
+    const su_subproc_result_t *result,
+    su_subproc_predicate_t predicate,
+    su_output_t output,
+    const char *stmt,
+    const char *test_name,
+    int line
+) {
+    su_framework_allocs();
+    const bool status_matches = su_subproc_predicate_matches_status(predicate, result->status);
+    const char *const got = output.standard_output ? result->standard_output
+                                                   : result->standard_error;
+    const bool output_matches = su_output_matches(output, got);
+    if (status_matches && output_matches) {
+        return false;
+    }
+    if (!su_failure_novel(su_failure_count(line, stmt), NULL)) {
+        return true;
+    }
+    printf("%s(%d): expected ", test_name, line);
+    if (!status_matches) {
+        char buf[32];
+        const char *const status = su_describe_status(result->status, buf, sizeof(buf));
+        if (predicate.any_abnormal) {
+            printf("abnormal exit, got %s\n", status);
+        } else if (predicate.is_signal) {
+            printf(
+                "killed by signal %d, got %s\n",
+                predicate.code_or_signal,
+                status
+            );
+        } else {
+            printf(
+                "exited with code %d, got %s\n",
+                predicate.code_or_signal,
+                status
+            );
+        }
+    } else {
+        su_print_output_expectation(output, got);
+    }
+    return true;
+}
+
+static int
+su_pidfd_open(int pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+enum {
+    SU_BATCH_STDERR,
+    SU_BATCH_STDOUT,
+    SU_BATCH_PIDFD,
+};
+
+static void
+su_batch_watch(su_subproc_batch_t *batch, int fd, size_t index, int kind) {
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = (uint64_t)index << 2 | kind};
+    if (epoll_ctl(batch->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+static void
+su_batch_unwatch(su_subproc_batch_t *batch, int *fd) {
+    epoll_ctl(batch->epoll_fd, EPOLL_CTL_DEL, *fd, NULL);
+    close(*fd);
+    *fd = -1;
+}
+
+static void
+su_batch_reap(su_subproc_pending_t *p) {
+    while (waitpid(p->info.pid, &p->result.status, 0) == -1 && errno == EINTR) {
+    }
+    su_untrack_child(p->info.pid);
+    su_trace_child("death test", p->info.pid, p->info.start);
+    p->exited = true;
+}
+
+/// Keeps the location of the children of `batch` up to date in `su__batches`.
+static void
+su_batch_register(su_subproc_batch_t *batch) {
+    for (int i = 0; i < arrlen(su__batches); ++i) {
+        if (su__batches[i].epoll_fd == batch->epoll_fd) {
+            su__batches[i].pending = batch->pending;
+            return;
+        }
+    }
+    arrput(su__batches, ((su_batch_resources_t){batch->epoll_fd, batch->pending}));
+}
+
+static void
+su_batch_unregister(su_subproc_batch_t *batch) {
+    for (int i = 0; i < arrlen(su__batches); ++i) {
+        if (su__batches[i].epoll_fd == batch->epoll_fd) {
+            arrdel(su__batches, i);
+            break;
+        }
+    }
+    if (!arrlen(su__batches)) {
+        arrfree(su__batches);
+    }
+}
+
+/// Finishes the child once it exited and its output is closed.
+static void
+su_batch_update(su_subproc_batch_t *batch, su_subproc_pending_t *p) {
+    if (p->info.rx != -1 || p->info.out_rx != -1 || p->result.standard_error) {
+        return;
+    }
+    if (!p->exited) {
+        // without a pidfd the closed output is the only sign the child is gone
+        if (p->pidfd != -1) {
+            return;
+        }
+        su_batch_reap(p);
+    }
+    p->result.standard_error = su_trim_output(&p->result._stderr_buf);
+    p->result.standard_output = su_trim_output(&p->result._stdout_buf);
+    --batch->running;
+}
+
+static void
+su_batch_step(su_subproc_batch_t *batch) {
+    struct epoll_event events[64];
+    const int n = epoll_wait(batch->epoll_fd, events, 64, -1);
+    if (n == -1) {
+        if (errno != EINTR) {
+            perror("epoll_wait");
+            exit(1);
+        }
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        su_subproc_pending_t *p = &batch->pending[events[i].data.u64 >> 2];
+        switch (events[i].data.u64 & 3) {
+        case SU_BATCH_STDERR:
+            if (!su_drain_fd(p->info.rx, &p->result._stderr_buf)) {
+                su_batch_unwatch(batch, &p->info.rx);
+            }
+            break;
+        case SU_BATCH_STDOUT:
+            if (!su_drain_fd(p->info.out_rx, &p->result._stdout_buf)) {
+                su_batch_unwatch(batch, &p->info.out_rx);
+            }
+            break;
+        case SU_BATCH_PIDFD:
+            su_batch_reap(p);
+            su_batch_unwatch(batch, &p->pidfd);
+            break;
+        }
+        su_batch_update(batch, p);
+    }
+}
+
+void
+su_subproc_batch_add(
+    su_subproc_batch_t *batch,
+    su_subproc_info_t info,
+    su_subproc_predicate_t predicate,
+    su_output_t output,
+    const char *stmt,
+    int line
+) {
+    su_framework_allocs();
+    if (!batch->pending) {
+        batch->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (batch->epoll_fd == -1) {
+            perror("epoll_create1");
+            exit(1);
+        }
+    }
+    const size_t index = arrlen(batch->pending);
+    su_subproc_pending_t *p = su_arrpush(batch->pending);
+    p->info = info;
+    p->pidfd = su_pidfd_open(info.pid);
+    p->predicate = predicate;
+    p->output = output;
+    p->stmt = stmt;
+    p->line = line;
+    // the pipes belong to the batch now
+    su__subproc_fds[0] = su__subproc_fds[1] = -1;
+    su_batch_register(batch);
+    su_batch_watch(batch, info.rx, index, SU_BATCH_STDERR);
+    su_batch_watch(batch, info.out_rx, index, SU_BATCH_STDOUT);
+    if (p->pidfd != -1) {
+        su_batch_watch(batch, p->pidfd, index, SU_BATCH_PIDFD);
+    }
+    ++batch->running;
+    while (batch->running >= SU_MAX_ASYNC_SUBPROCS) {
+        su_batch_step(batch);
+    }
+}
+
+bool
+su_subproc_batch_wait(su_subproc_batch_t *batch, const char *test_name) {
+    su_framework_allocs();
+    if (!batch->pending) {
+        return false;
+    }
+    while (batch->running) {
+        su_batch_step(batch);
+    }
+    bool failed = false;
+    for (int i = 0; i < arrlen(batch->pending); ++i) {
+        su_subproc_pending_t *p = &batch->pending[i];
+        failed |= su_check_subproc_result(
+            &p->result, p->predicate, p->output, p->stmt, test_name, p->line
+        );
+        su_subproc_result_drop(&p->result);
+    }
+    su_batch_unregister(batch);
+    close(batch->epoll_fd);
+    arrfree(batch->pending);
+    batch->running = 0;
+    return failed;
+}
+
+/// Closes and frees what the death tests of a test that timed out left behind, the children
+/// themselves are killed by `su_kill_children`.
+static void
+su_subproc_release(void) {
+    su_framework_allocs();
+    for (int i = 0; i < 2; ++i) {
+        if (su__subproc_fds[i] != -1) {
+            close(su__subproc_fds[i]);
+            su__subproc_fds[i] = -1;
+        }
+        arrfree(su__subproc_bufs[i]);
+    }
+    for (int i = 0; i < arrlen(su__batches); ++i) {
+        su_subproc_pending_t *pending = su__batches[i].pending;
+        for (int j = 0; j < arrlen(pending); ++j) {
+            const int fds[] = {pending[j].info.rx, pending[j].info.out_rx, pending[j].pidfd};
+            for (int k = 0; k < 3; ++k) {
+                if (fds[k] != -1) {
+                    close(fds[k]);
+                }
+            }
+            su_subproc_result_drop(&pending[j].result);
+        }
+        arrfree(pending);
+        close(su__batches[i].epoll_fd);
+    }
+    arrfree(su__batches);
+}
+
+// MARK: - Benchmarks
+
+/// Size read to evict the data caches, twice the last level cache.
+static size_t su__flush_size;
+static char *su__flush_buf;
+
+static void
+su_bench_flush_init(void) {
+    su_framework_allocs();
+    const long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    su__flush_size = 2 * (llc > 0 ? (size_t)llc : 32u << 20);
+    su__flush_buf = malloc(su__flush_size);
+    if (su__flush_buf) {
+        // untouched pages all map the zero page, which would stay cached
+        memset(su__flush_buf, 1, su__flush_size);
+    }
+}
+
+static void
+su_bench_flush_cache(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, su_bench_flush_init);
+    if (!su__flush_buf) {
+        return;
+    }
+    // only reading keeps concurrent benchmarks from racing on the buffer
+    uint64_t sum = 0;
+    for (size_t i = 0; i < su__flush_size; i += 64) {
+        sum += (unsigned char)su__flush_buf[i];
+    }
+    __asm__ volatile("" : : "r"(sum));
+}
+
+uint64_t
+su_bench_start(su_bench_t *bench) {
+    if (bench->options.cache == SU_BENCH_CACHE_FLUSH) {
+        su_bench_flush_cache();
+    }
+    su_counters_resume();
+    bench->start = su_time_now(CLOCK_MONOTONIC);
+    return bench->iterations;
+}
+
+bool
+su_bench_stop(su_bench_t *bench) {
+    bench->elapsed = su_time_sub(su_time_now(CLOCK_MONOTONIC), bench->start);
+    su_counters_pause();
+    su__counter_iterations += bench->iterations;
+    bench->measured = true;
+    return true;
+}
+
+static int
+su_compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void
+su_bench_compute_stats(su_bench_stats_t *stats, double *samples, size_t count) {
+    qsort(samples, count, sizeof(*samples), su_compare_doubles);
+    double sum = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += samples[i];
+    }
+    stats->mean = sum / count;
+    stats->median = count % 2 ? samples[count / 2]
+                              : (samples[count / 2 - 1] + samples[count / 2]) / 2.0;
+    stats->min = samples[0];
+    double variance = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        variance += (samples[i] - stats->mean) * (samples[i] - stats->mean);
+    }
+    stats->stddev = count > 1 ? sqrt(variance / (count - 1)) : 0.0;
+}
+
+static void
+su_format_ns(char *buf, size_t size, double ns) {
+    if (ns < 1e3) {
+        snprintf(buf, size, "%.2fns", ns);
+    } else if (ns < 1e6) {
+        snprintf(buf, size, "%.2fus", ns / 1e3);
+    } else if (ns < 1e9) {
+        snprintf(buf, size, "%.2fms", ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    }
+}
+
+double
+su_mann_whitney_p(const double *x, size_t n, const double *y, size_t m) {
+    if (!n || !m) {
+        return 1.0;
+    }
+    double u = 0.0;
+    for (size_t j = 0; j < m; ++j) {
+        for (size_t i = 0; i < n; ++i) {
+            u += y[j] > x[i] ? 1.0 : y[j] == x[i] ? 0.5 : 0.0;
+        }
+    }
+    // ties shrink the variance, each group of t equal values by (t^3 - t) / 12
+    double *all = malloc((n + m) * sizeof(*all));
+    memcpy(all, x, n * sizeof(*x));
+    memcpy(all + n, y, m * sizeof(*y));
+    qsort(all, n + m, sizeof(*all), su_compare_doubles);
+    double ties = 0.0;
+    for (size_t i = 0, j; i < n + m; i = j) {
+        for (j = i + 1; j < n + m && all[j] == all[i]; ++j) {
+        }
+        const double t = (double)(j - i);
+        ties += t * t * t - t;
+    }
+    free(all);
+    const double total = (double)(n + m);
+    const double variance = n * m / 12.0 * (total + 1.0 - ties / (total * (total - 1.0)));
+    if (variance <= 0.0) {
+        return 1.0;
+    }
+    // normal approximation with continuity correction
+    const double z = (u - n * m / 2.0 - 0.5) / sqrt(variance);
+    return 0.5 * erfc(z / sqrt(2.0));
+}
+
+/// Fails the benchmark if its samples are significantly above those of its baseline increased
+/// by the regression threshold.
+static void
+su_bench_check_baseline(su_test_t *test) {
+    const su_bench_t *bench = test->bench;
+    const double *old = bench->baseline->samples;
+    const size_t old_count = arrlen(old);
+    const double factor = 1.0 + su__state.options.regression_threshold / 100.0;
+    double limit[SU_BENCH_SAMPLES];
+    // compare against the baseline slowed down by the threshold, scaling ours down is the same
+    for (size_t i = 0; i < SU_BENCH_SAMPLES; ++i) {
+        limit[i] = bench->stats.samples[i] / factor;
+    }
+    const double p = su_mann_whitney_p(old, old_count, limit, SU_BENCH_SAMPLES);
+    if (p >= SU_BASELINE_ALPHA) {
+        return;
+    }
+    const double old_median = old_count % 2
+                                ? old[old_count / 2]
+                                : (old[old_count / 2 - 1] + old[old_count / 2]) / 2.0;
+    char now[32], before[32];
+    su_format_ns(now, sizeof(now), bench->stats.median);
+    su_format_ns(before, sizeof(before), old_median);
+    fprintf(
+        stderr,
+        "%s: regressed by %.1f%% (median %s/iter, baseline %s/iter, p = %.2g)\n",
+        test->pretty_name,
+        (bench->stats.median / old_median - 1.0) * 100.0,
+        now,
+        before,
+        p
+    );
+    test->status = SU_FAIL;
+}
+
+static const char *const SU_COMPLEXITY_NAMES[SU_COMPLEXITY_COUNT] = {
+    [SU_COMPLEXITY_NONE] = "none",
+    [SU_O_1] = "O(1)",
+    [SU_O_LOG_N] = "O(log n)",
+    [SU_O_N] = "O(n)",
+    [SU_O_N_LOG_N] = "O(n log n)",
+    [SU_O_N2] = "O(n^2)",
+};
+
+const char *
+su_complexity_name(su_complexity_t complexity) {
+    return (unsigned)complexity < SU_COMPLEXITY_COUNT ? SU_COMPLEXITY_NAMES[complexity] : "?";
+}
+
+static double
+su_complexity_fn(su_complexity_t complexity, double n) {
+    switch (complexity) {
+    case SU_O_1: return 1.0;
+    case SU_O_LOG_N: return log2(n);
+    case SU_O_N: return n;
+    case SU_O_N_LOG_N: return n * log2(n);
+    case SU_O_N2: return n * n;
+    default: return 0.0;
+    }
+}
+
+su_complexity_t
+su_fit_complexity(const su_bench_point_t *points, size_t count, double *rms) {
+    su_complexity_t best = SU_COMPLEXITY_NONE;
+    *rms = 0.0;
+    if (count < 2) {
+        return best;
+    }
+    // residuals are relative to the times, otherwise the largest sizes decide alone: minimizing
+    // sum((1 - c * f / t)^2) gives c = sum(f / t) / sum((f / t)^2)
+    // ties go to the slower growing class
+    for (int c = SU_O_1; c < SU_COMPLEXITY_COUNT; ++c) {
+        double sum = 0.0, squares = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            const double ratio = su_complexity_fn(c, (double)points[i].n) / points[i].median;
+            sum += ratio;
+            squares += ratio * ratio;
+        }
+        const double coefficient = squares > 0.0 ? sum / squares : 0.0;
+        double residuals = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            const double ratio = su_complexity_fn(c, (double)points[i].n) / points[i].median;
+            residuals += (1.0 - coefficient * ratio) * (1.0 - coefficient * ratio);
+        }
+        const double error = sqrt(residuals / count);
+        if (best == SU_COMPLEXITY_NONE || error < *rms) {
+            best = c;
+            *rms = error;
+        }
+    }
+    return best;
+}
+
+static su_bench_counter_t *
+su_bench_find_counter(su_bench_throughput_t *throughput, const char *name) {
+    for (uint32_t i = 0; i < throughput->counter_count; ++i) {
+        if (su_streq(throughput->counters[i].name, name)) {
+            return &throughput->counters[i];
+        }
+    }
+    if (throughput->counter_count == SU_BENCH_COUNTERS) {
+        return NULL;
+    }
+    su_bench_counter_t *counter = &throughput->counters[throughput->counter_count++];
+    *counter = (su_bench_counter_t){.name = name};
+    return counter;
+}
+
+void
+su_bench_add_counter(su_test_t *test, const char *name, double value, bool rate, int line) {
+    su_bench_counter_t *counter = su_bench_find_counter(&test->bench->call, name);
+    if (counter) {
+        counter->value += value;
+        counter->rate = rate;
+        return;
+    }
+    if (su_failure_novel(su_failure_count(line, name), NULL)) {
+        fprintf(
+            stderr,
+            "%s(%d): more than %d benchmark counters, %s is dropped\n",
+            test->pretty_name,
+            line,
+            SU_BENCH_COUNTERS,
+            name
+        );
+    }
+    test->status = SU_FAIL;
+}
+
+/// Adds what one call of the benchmark declared to the totals of its samples.
+static void
+su_bench_accumulate(su_bench_throughput_t *total, const su_bench_throughput_t *call) {
+    total->bytes = call->bytes;
+    total->items = call->items;
+    for (uint32_t i = 0; i < call->counter_count; ++i) {
+        su_bench_counter_t *counter = su_bench_find_counter(total, call->counters[i].name);
+        if (counter) {
+            counter->value += call->counters[i].value;
+            counter->rate = call->counters[i].rate;
+        }
+    }
+}
+
+/// Runs the benchmark once with the given number of iterations, returns `false` if it failed.
+static bool
+su_bench_run_once(su_module_t *mod, void *object, su_test_t *test, uint64_t iterations) {
+    su_bench_t *bench = test->bench;
+    bench->iterations = iterations;
+    bench->measured = false;
+    bench->call = (su_bench_throughput_t){0};
+    mod->vtable->run(mod, object, test);
+    if (test->status != SU_PASS) {
+        return false;
+    }
+    if (!bench->measured) {
+        fprintf(stderr, "%s.%s: benchmark does not use su_bench_loop\n", mod->name, test->name);
+        test->status = SU_FAIL;
+        return false;
+    }
+    return true;
+}
+
+/// Like `su_bench_run_once` but not counted by `--counters`.
+static bool
+su_bench_run_untimed(su_module_t *mod, void *object, su_test_t *test, uint64_t iterations) {
+    const bool counting = su__counting;
+    su__counting = false;
+    const bool ok = su_bench_run_once(mod, object, test, iterations);
+    su__counting = counting;
+    return ok;
+}
+
+/// Runs the benchmark for `warmup_ms` with doubling iterations, returns `false` if it failed.
+static bool
+su_bench_warm_up(su_module_t *mod, void *object, su_test_t *test) {
+    su_bench_t *bench = test->bench;
+    const double warmup_ns = bench->options.warmup_ms * 1e6;
+    double elapsed = 0.0;
+    for (uint64_t iterations = 1; elapsed < warmup_ns; iterations *= 2) {
+        if (!su_bench_run_untimed(mod, object, test, iterations)) {
+            return false;
+        }
+        elapsed += bench->elapsed.value;
+        if (iterations >= UINT64_MAX / 4) {
+            break;
+        }
+    }
+    return true;
+}
+
+/// Warns once if the CPU running a benchmark may change its frequency while it runs.
+static void
+su_bench_check_governor(void) {
+    static atomic_flag checked = ATOMIC_FLAG_INIT;
+    if (atomic_flag_test_and_set(&checked)) {
+        return;
+    }
+    su_framework_allocs();
+    const int cpu = sched_getcpu();
+    char path[96], governor[32];
+    snprintf(
+        path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+        cpu < 0 ? 0 : cpu
+    );
+    // virtual machines usually have no cpufreq at all
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return;
+    }
+    if (fgets(governor, sizeof(governor), file)) {
+        governor[strcspn(governor, "\n")] = '\0';
+        if (!su_streq(governor, "performance")) {
+            fprintf(
+                stderr,
+                "warning: CPU frequency scaling governor is %s, not performance, benchmark "
+                "results may vary\n",
+                governor
+            );
+        }
+    }
+    fclose(file);
+}
+
+/// Pins this thread to the CPU it is running on, `*saved` receives the previous affinity.
+static bool
+su_bench_pin(cpu_set_t *saved) {
+    const int cpu = sched_getcpu();
+    if (cpu < 0 || sched_getaffinity(0, sizeof(*saved), saved) == -1) {
+        perror("sched_getaffinity");
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        perror("sched_setaffinity");
+        return false;
+    }
+    return true;
+}
+
+/// Scales the number of iterations until one sample takes `bench_time_ms / SU_BENCH_SAMPLES`,
+/// then takes `SU_BENCH_SAMPLES` samples, returns `false` if the benchmark failed.
+static bool
+su_bench_measure(su_module_t *mod, void *object, su_test_t *test) {
+    su_bench_t *bench = test->bench;
+    const double sample_ns = su__state.options.bench_time_ms * 1e6 / SU_BENCH_SAMPLES;
+    uint64_t iterations = 1;
+    bench->stats = (su_bench_stats_t){0};
+    if (bench->options.warmup_ms && !su_bench_warm_up(mod, object, test)) {
+        return false;
+    }
+    for (;;) {
+        if (!su_bench_run_once(mod, object, test, iterations)) {
+            return false;
+        }
+        const double elapsed = bench->elapsed.value;
+        if (elapsed >= sample_ns || iterations >= UINT64_MAX / 10) {
+            break;
+        }
+        // overshoot a little so we usually need only one more round
+        double factor = elapsed > 0.0 ? sample_ns * 1.4 / elapsed : 10.0;
+        factor = factor < 2.0 ? 2.0 : factor > 10.0 ? 10.0 : factor;
+        iterations = (uint64_t)(iterations * factor);
+    }
+    double samples[SU_BENCH_SAMPLES];
+    su_bench_throughput_t throughput = {0};
+    double elapsed = 0.0;
+    for (size_t i = 0; i < SU_BENCH_SAMPLES; ++i) {
+        if (bench->options.cache == SU_BENCH_CACHE_WARM
+            && !su_bench_run_untimed(mod, object, test, 1)) {
+            return false;
+        }
+        if (!su_bench_run_once(mod, object, test, iterations)) {
+            return false;
+        }
+        samples[i] = (double)bench->elapsed.value / iterations;
+        elapsed += bench->elapsed.value;
+        su_bench_accumulate(&throughput, &bench->call);
+    }
+    su_bench_compute_stats(&bench->stats, samples, SU_BENCH_SAMPLES);
+    bench->stats.iterations = iterations;
+    memcpy(bench->stats.samples, samples, sizeof(samples));
+    for (uint32_t i = 0; i < throughput.counter_count; ++i) {
+        su_bench_counter_t *counter = &throughput.counters[i];
+        counter->value /= counter->rate ? elapsed / 1e9 : (double)iterations * SU_BENCH_SAMPLES;
+    }
+    bench->stats.throughput = throughput;
+    return true;
+}
+
+/// Measures each size of a `su_bench_range` and fits the complexity of the medians, returns
+/// `false` if the benchmark failed.
+static bool
+su_bench_measure_range(su_module_t *mod, void *object, su_test_t *test) {
+    su_bench_t *bench = test->bench;
+    su_bench_point_t points[SU_BENCH_RANGE_POINTS];
+    uint32_t count = 0;
+    if (!bench->range_lo || bench->range_lo > bench->range_hi || bench->range_mult < 2) {
+        fprintf(stderr, "%s: invalid benchmark range\n", test->pretty_name);
+        test->status = SU_FAIL;
+        return false;
+    }
+    for (uint64_t n = bench->range_lo; n <= bench->range_hi; n *= bench->range_mult) {
+        if (count == SU_BENCH_RANGE_POINTS) {
+            fprintf(
+                stderr, "%s: more than %d sizes in benchmark range\n", test->pretty_name,
+                SU_BENCH_RANGE_POINTS
+            );
+            test->status = SU_FAIL;
+            return false;
+        }
+        bench->n = n;
+        if (!su_bench_measure(mod, object, test)) {
+            return false;
+        }
+        points[count++] = (su_bench_point_t){
+            .n = n,
+            .median = bench->stats.median,
+            .bytes = bench->stats.throughput.bytes,
+            .items = bench->stats.throughput.items,
+        };
+        if (n > UINT64_MAX / bench->range_mult) {
+            break;
+        }
+    }
+    su_bench_stats_t *stats = &bench->stats;
+    memcpy(stats->points, points, count * sizeof(*points));
+    stats->point_count = count;
+    stats->complexity = su_fit_complexity(points, count, &stats->complexity_rms);
+    const su_complexity_t expected = bench->expected_complexity;
+    if (expected != SU_COMPLEXITY_NONE && stats->complexity > expected) {
+        fprintf(
+            stderr,
+            "%s: expected %s, measured %s (rms %.1f%%)\n",
+            test->pretty_name,
+            su_complexity_name(expected),
+            su_complexity_name(stats->complexity),
+            stats->complexity_rms * 100.0
+        );
+        test->status = SU_FAIL;
+    }
+    return true;
+}
+
+static void
+su_bench_run(su_module_t *mod, void *object, su_test_t *test) {
+    su_bench_t *bench = test->bench;
+    su_bench_check_governor();
+    cpu_set_t saved;
+    const bool pinned = bench->options.pin && su_bench_pin(&saved);
+    const bool measured = bench->range_mult ? su_bench_measure_range(mod, object, test)
+                                            : su_bench_measure(mod, object, test);
+    if (pinned) {
+        sched_setaffinity(0, sizeof(saved), &saved);
+    }
+    if (measured && bench->baseline && !su__state.options.update_baseline) {
+        su_bench_check_baseline(test);
+    }
+}
+
+// MARK: - Reporters
+
+static const char *
+su_style(const su_reporter_t *reporter, const char *escape) {
+    return reporter->color ? escape : "";
+}
+
+static void
+su_console_print_results(su_reporter_t *r, const su_count_t *counts, su_time_t runtime) {
+    static const char *const COLORS[] = {"\x1b[32m", "\x1b[31m", "\x1b[33m", "\x1b[35m"};
+    static const char *const WORDS[] = {"passing", "failing", "skipped", "timed out"};
+    const char *sep = "";
+    for (int status = 0; status < SU_STATUS_COUNT; ++status) {
+        if (counts[status]) {
+            fprintf(
+                r->out,
+                "%s%s%u %s%s",
+                sep,
+                su_style(r, COLORS[status]),
+                counts[status],
+                WORDS[status],
+                su_style(r, "\x1b[m")
+            );
+            sep = " ";
+        }
+    }
+    const char *dim = su_style(r, "\x1b[2m");
+    const char *reset = su_style(r, "\x1b[m");
+    const double ms = su_time_ms(runtime);
+    if (ms >= 1000.0) {
+        fprintf(r->out, " %s(%.2fs)%s\n", dim, ms / 1000.0, reset);
+    } else if (ms < 1.0) {
+        fprintf(r->out, " %s(%luus)%s\n", dim, (unsigned long)(runtime.value / 1000), reset);
+    } else {
+        fprintf(r->out, " %s(%lums)%s\n", dim, (unsigned long)(ms + 0.5), reset);
+    }
+}
+
+static void
+su_reporter_skip_begin(su_reporter_t *r, size_t test_count) {
+    (void)r;
+    (void)test_count;
+}
+
+static void
+su_reporter_skip_module(su_reporter_t *r, const su_module_t *mod) {
+    (void)r;
+    (void)mod;
+}
+
+static void
+su_console_module_begin(su_reporter_t *r, const su_module_t *mod) {
+    fprintf(r->out, "  %s\n", mod->name);
+}
+
+static void
+su_console_print_bench_stats(su_reporter_t *r, const su_bench_stats_t *stats) {
+    char mean[32], median[32], stddev[32], min[32];
+    su_format_ns(mean, sizeof(mean), stats->mean);
+    su_format_ns(median, sizeof(median), stats->median);
+    su_format_ns(stddev, sizeof(stddev), stats->stddev);
+    su_format_ns(min, sizeof(min), stats->min);
+    fprintf(
+        r->out,
+        "      %s%s/iter (mean %s, median %s, stddev %s, min %s, %lu iterations)%s\n",
+        su_style(r, "\x1b[2m"),
+        median,
+        mean,
+        median,
+        stddev,
+        min,
+        (unsigned long)stats->iterations,
+        su_style(r, "\x1b[m")
+    );
+}
+
+static void
+su_console_print_timing(su_reporter_t *r, const su_test_t *test) {
+    char wall[32], cpu[32];
+    su_format_ns(wall, sizeof(wall), test->runtime.value);
+    su_format_ns(cpu, sizeof(cpu), test->cpu_time.value);
+    fprintf(
+        r->out,
+        "      %swall %s, cpu %s, max rss +%ldkB, faults %ld/%ld, switches %ld/%ld%s\n",
+        su_style(r, "\x1b[2m"),
+        wall,
+        cpu,
+        test->usage.max_rss_kb,
+        test->usage.minor_faults,
+        test->usage.major_faults,
+        test->usage.voluntary_switches,
+        test->usage.involuntary_switches,
+        su_style(r, "\x1b[m")
+    );
+#ifdef SU_TRACK_ALLOCS
+    fprintf(
+        r->out,
+        "      %sallocs %lu, frees %lu, bytes %lu, peak live %ld%s\n",
+        su_style(r, "\x1b[2m"),
+        (unsigned long)test->allocs.allocs,
+        (unsigned long)test->allocs.frees,
+        (unsigned long)test->allocs.bytes,
+        (long)test->allocs.peak_live,
+        su_style(r, "\x1b[m")
+    );
+#endif
+}
+
+static void
+su_format_count(char *buf, size_t size, double count) {
+    if (count < 1e3) {
+        snprintf(buf, size, "%.4g", count);
+    } else if (count < 1e6) {
+        snprintf(buf, size, "%.2fk", count / 1e3);
+    } else if (count < 1e9) {
+        snprintf(buf, size, "%.2fM", count / 1e6);
+    } else {
+        snprintf(buf, size, "%.2fG", count / 1e9);
+    }
+}
+
+/// Prints the median of each size, with the throughput if each iteration handles `n` items.
+static void
+su_console_print_bench_range(su_reporter_t *r, const su_bench_stats_t *stats) {
+    for (uint32_t i = 0; i < stats->point_count; ++i) {
+        const su_bench_point_t *point = &stats->points[i];
+        char median[32], items[32], bytes[32] = "";
+        su_format_ns(median, sizeof(median), point->median);
+        // without declared items an iteration handles `n`
+        const double per_iteration = point->items ? point->items : (double)point->n;
+        su_format_count(items, sizeof(items), per_iteration * 1e9 / point->median);
+        if (point->bytes) {
+            su_format_count(bytes, sizeof(bytes), point->bytes * 1e9 / point->median);
+        }
+        fprintf(
+            r->out,
+            "      %sn = %lu: %s/iter, %s items/s%s%s%s%s\n",
+            su_style(r, "\x1b[2m"),
+            (unsigned long)point->n,
+            median,
+            items,
+            *bytes ? ", " : "",
+            bytes,
+            *bytes ? "B/s" : "",
+            su_style(r, "\x1b[m")
+        );
+    }
+    if (stats->complexity != SU_COMPLEXITY_NONE) {
+        fprintf(
+            r->out,
+            "      %sbest fit %s (rms %.1f%%)%s\n",
+            su_style(r, "\x1b[2m"),
+            su_complexity_name(stats->complexity),
+            stats->complexity_rms * 100.0,
+            su_style(r, "\x1b[m")
+        );
+    }
+}
+
+/// Prints what a benchmark declared, `rates` adds its bytes and items per second.
+static void
+su_console_print_throughput(su_reporter_t *r, const su_bench_stats_t *stats, bool rates) {
+    const su_bench_throughput_t *throughput = &stats->throughput;
+    rates = rates && (throughput->bytes || throughput->items);
+    if (!rates && !throughput->counter_count) {
+        return;
+    }
+    char value[32];
+    const char *sep = "";
+    fprintf(r->out, "      %s", su_style(r, "\x1b[2m"));
+    if (rates && throughput->bytes) {
+        su_format_count(value, sizeof(value), throughput->bytes * 1e9 / stats->median);
+        fprintf(r->out, "%sB/s", value);
+        sep = ", ";
+    }
+    if (rates && throughput->items) {
+        su_format_count(value, sizeof(value), throughput->items * 1e9 / stats->median);
+        fprintf(r->out, "%s%s items/s", sep, value);
+        sep = ", ";
+    }
+    for (uint32_t i = 0; i < throughput->counter_count; ++i) {
+        const su_bench_counter_t *counter = &throughput->counters[i];
+        su_format_count(value, sizeof(value), counter->value);
+        fprintf(r->out, "%s%s %s/%s", sep, counter->name, value, counter->rate ? "s" : "iter");
+        sep = ", ";
+    }
+    fprintf(r->out, "%s\n", su_style(r, "\x1b[m"));
+}
+
+/// Prints the counters of a test, those of benchmarks per iteration.
+static void
+su_console_print_counters(su_reporter_t *r, const su_counters_t *counters) {
+    static const char *const LABELS[SU_COUNTER_COUNT] = {
+        "cycles",
+        "instructions",
+        "branch misses",
+        "L1d misses",
+        "LLC misses",
+        "dTLB misses",
+        "task clock",
+        "page faults",
+    };
+    const double divisor = counters->iterations ? counters->iterations : 1;
+    fprintf(r->out, "      %s%s", su_style(r, "\x1b[2m"), counters->iterations ? "per iter: " : "");
+    const char *sep = "";
+    for (int i = 0; i < SU_COUNTER_COUNT; ++i) {
+        if (!(counters->mask & 1u << i)) {
+            continue;
+        }
+        char value[32];
+        if (i == SU_COUNTER_TASK_CLOCK) {
+            su_format_ns(value, sizeof(value), counters->values[i] / divisor);
+        } else {
+            su_format_count(value, sizeof(value), counters->values[i] / divisor);
+        }
+        fprintf(r->out, "%s%s %s", sep, LABELS[i], value);
+        sep = ", ";
+        const uint64_t cycles = counters->values[SU_COUNTER_CYCLES];
+        if (i == SU_COUNTER_INSTRUCTIONS && cycles) {
+            fprintf(r->out, " (IPC %.2f)", (double)counters->values[i] / cycles);
+        }
+    }
+    fprintf(r->out, "%s\n", su_style(r, "\x1b[m"));
+}
+
+static void
+su_console_test_end(su_reporter_t *r, const su_test_t *test) {
+    fprintf(
+        r->out,
+        "    %s %s%s%s\n",
+        r->color ? SU_STATUS_LABELS[test->status] : SU_PLAIN_STATUS_LABELS[test->status],
+        su_style(r, "\x1b[2m"),
+        test->name,
+        su_style(r, "\x1b[m")
+    );
+    if (test->bench && test->status == SU_PASS) {
+        const su_bench_stats_t *stats = &test->bench->stats;
+        if (stats->point_count) {
+            su_console_print_bench_range(r, stats);
+        } else {
+            su_console_print_bench_stats(r, stats);
+        }
+        su_console_print_throughput(r, stats, !stats->point_count);
+    }
+    if (r->timing) {
+        su_console_print_timing(r, test);
+    }
+    if (test->counters.mask) {
+        su_console_print_counters(r, &test->counters);
+    }
+}
+
+static void
+su_console_module_end(su_reporter_t *r, const su_module_t *mod) {
+    fputs("\n  ", r->out);
+    su_console_print_results(r, mod->counts, mod->runtime);
+    fputc('\n', r->out);
+}
+
+static void
+su_console_end(su_reporter_t *r, const su_result_t *result) {
+    fputs("Total:\n  ", r->out);
+    su_console_print_results(r, result->counts, result->runtime);
+}
+
+static const su_reporter_vtable_t SU_CONSOLE_REPORTER = {
+    .begin = su_reporter_skip_begin,
+    .module_begin = su_console_module_begin,
+    .test_end = su_console_test_end,
+    .module_end = su_console_module_end,
+    .end = su_console_end,
+};
+
+typedef struct {
+    char name[64];
+    double value;
+} su_bench_metric_t;
+
+#define SU_BENCH_METRICS (2 + SU_BENCH_COUNTERS)
+
+/// Rates and counters declared by a benchmark, as named values.
+static size_t
+su_bench_metrics(const su_bench_stats_t *stats, su_bench_metric_t *metrics) {
+    const su_bench_throughput_t *throughput = &stats->throughput;
+    size_t count = 0;
+    if (throughput->bytes) {
+        metrics[count++]
+            = (su_bench_metric_t){"bytes_per_second", throughput->bytes * 1e9 / stats->median};
+    }
+    if (throughput->items) {
+        metrics[count++]
+            = (su_bench_metric_t){"items_per_second", throughput->items * 1e9 / stats->median};
+    }
+    for (uint32_t i = 0; i < throughput->counter_count; ++i) {
+        const su_bench_counter_t *counter = &throughput->counters[i];
+        su_bench_metric_t *metric = &metrics[count++];
+        snprintf(
+            metric->name,
+            sizeof(metric->name),
+            "%s_per_%s",
+            counter->name,
+            counter->rate ? "second" : "iteration"
+        );
+        metric->value = counter->value;
+    }
+    return count;
+}
+
+/// Timing statistics of a benchmark followed by its `su_bench_metrics`.
+static size_t
+su_bench_all_metrics(const su_bench_stats_t *stats, su_bench_metric_t *metrics) {
+    const su_bench_metric_t timing[] = {
+        {"mean_ns", stats->mean},
+        {"median_ns", stats->median},
+        {"stddev_ns", stats->stddev},
+        {"min_ns", stats->min},
+        {"iterations", (double)stats->iterations},
+    };
+    memcpy(metrics, timing, sizeof(timing));
+    const size_t count = sizeof(timing) / sizeof(*timing);
+    return count + su_bench_metrics(stats, metrics + count);
+}
+
+static void
+su_jsonl_module_begin(su_reporter_t *r, const su_module_t *mod) {
+    fputs("{\"event\":\"module_begin\",\"module\":\"", r->out);
+    su_json_escape(r->out, mod->name);
+    fputs("\"}\n", r->out);
+}
+
+static void
+su_jsonl_test_end(su_reporter_t *r, const su_test_t *test) {
+    fputs("{\"event\":\"test\",\"module\":\"", r->out);
+    su_json_escape(r->out, test->module->name);
+    fputs("\",\"test\":\"", r->out);
+    su_json_escape(r->out, test->name);
+    fprintf(
+        r->out,
+        "\",\"status\":\"%s\",\"wall_ns\":%lu,\"cpu_ns\":%lu,\"max_rss_kb\":%ld,"
+        "\"minor_faults\":%ld,\"major_faults\":%ld",
+        SU_STATUS_NAMES[test->status],
+        (unsigned long)test->runtime.value,
+        (unsigned long)test->cpu_time.value,
+        test->usage.max_rss_kb,
+        test->usage.minor_faults,
+        test->usage.major_faults
+    );
+#ifdef SU_TRACK_ALLOCS
+    fprintf(
+        r->out,
+        ",\"allocs\":%lu,\"frees\":%lu,\"alloc_bytes\":%lu,\"peak_live_bytes\":%ld",
+        (unsigned long)test->allocs.allocs,
+        (unsigned long)test->allocs.frees,
+        (unsigned long)test->allocs.bytes,
+        (long)test->allocs.peak_live
+    );
+#endif
+    if (test->counters.mask) {
+        fputs(",\"counters\":{", r->out);
+        const char *sep = "";
+        if (test->counters.iterations) {
+            fprintf(r->out, "\"iterations\":%lu", (unsigned long)test->counters.iterations);
+            sep = ",";
+        }
+        for (int i = 0; i < SU_COUNTER_COUNT; ++i) {
+            if (test->counters.mask & 1u << i) {
+                fprintf(
+                    r->out,
+                    "%s\"%s\":%lu",
+                    sep,
+                    SU_COUNTER_NAMES[i],
+                    (unsigned long)test->counters.values[i]
+                );
+                sep = ",";
+            }
+        }
+        fputc('}', r->out);
+    }
+    if (test->bench && test->status == SU_PASS) {
+        const su_bench_stats_t *stats = &test->bench->stats;
+        fprintf(
+            r->out,
+            ",\"bench\":{\"mean_ns\":%.3f,\"median_ns\":%.3f,\"stddev_ns\":%.3f,"
+            "\"min_ns\":%.3f,\"iterations\":%lu",
+            stats->mean,
+            stats->median,
+            stats->stddev,
+            stats->min,
+            (unsigned long)stats->iterations
+        );
+        su_bench_metric_t metrics[SU_BENCH_METRICS];
+        const size_t metric_count = su_bench_metrics(stats, metrics);
+        for (size_t i = 0; i < metric_count; ++i) {
+            fputs(",\"", r->out);
+            su_json_escape(r->out, metrics[i].name);
+            fprintf(r->out, "\":%.6g", metrics[i].value);
+        }
+        if (stats->point_count) {
+            fputs(",\"range\":[", r->out);
+            for (uint32_t i = 0; i < stats->point_count; ++i) {
+                fprintf(
+                    r->out,
+                    "%s{\"n\":%lu,\"median_ns\":%.3f}",
+                    i ? "," : "",
+                    (unsigned long)stats->points[i].n,
+                    stats->points[i].median
+                );
+            }
+            fprintf(
+                r->out,
+                "],\"complexity\":\"%s\",\"complexity_rms\":%.4f",
+                su_complexity_name(stats->complexity),
+                stats->complexity_rms
+            );
+        }
+        fputc('}', r->out);
+    }
+    fputs("}\n", r->out);
+}
+
+static void
+su_jsonl_print_counts(su_reporter_t *r, const su_count_t *counts, su_time_t runtime) {
+    for (int status = 0; status < SU_STATUS_COUNT; ++status) {
+        fprintf(r->out, ",\"%s\":%u", SU_STATUS_NAMES[status], counts[status]);
+    }
+    fprintf(r->out, ",\"wall_ns\":%lu}\n", (unsigned long)runtime.value);
+}
+
+static void
+su_jsonl_module_end(su_reporter_t *r, const su_module_t *mod) {
+    fputs("{\"event\":\"module_end\",\"module\":\"", r->out);
+    su_json_escape(r->out, mod->name);
+    fputc('"', r->out);
+    su_jsonl_print_counts(r, mod->counts, mod->runtime);
+}
+
+static void
+su_jsonl_end(su_reporter_t *r, const su_result_t *result) {
+    fputs("{\"event\":\"end\"", r->out);
+    su_jsonl_print_counts(r, result->counts, result->runtime);
+}
+
+static const su_reporter_vtable_t SU_JSONL_REPORTER = {
+    .begin = su_reporter_skip_begin,
+    .module_begin = su_jsonl_module_begin,
+    .test_end = su_jsonl_test_end,
+    .module_end = su_jsonl_module_end,
+    .end = su_jsonl_end,
+};
+
+static void
+su_tap_begin(su_reporter_t *r, size_t test_count) {
+    fprintf(r->out, "TAP version 13\n1..%zu\n", test_count);
+}
+
+static void
+su_tap_module_begin(su_reporter_t *r, const su_module_t *mod) {
+    fprintf(r->out, "# %s\n", mod->name);
+}
+
+static void
+su_tap_test_end(su_reporter_t *r, const su_test_t *test) {
+    static const char *const SUFFIXES[] = {"", "", " # SKIP", " # timed out"};
+    fprintf(
+        r->out,
+        "%s %zu - %s%s\n",
+        test->status == SU_PASS || test->status == SU_SKIP ? "ok" : "not ok",
+        ++r->test_number,
+        test->pretty_name,
+        SUFFIXES[test->status]
+    );
+    if (test->bench && test->status == SU_PASS) {
+        su_bench_metric_t metrics[5 + SU_BENCH_METRICS];
+        const size_t count = su_bench_all_metrics(&test->bench->stats, metrics);
+        fputs("  ---\n", r->out);
+        // double quoted YAML keys use the escapes of JSON
+        for (size_t i = 0; i < count; ++i) {
+            fputs("  \"", r->out);
+            su_json_escape(r->out, metrics[i].name);
+            fprintf(r->out, "\": %.6g\n", metrics[i].value);
+        }
+        fputs("  ...\n", r->out);
+    }
+}
+
+static void
+su_tap_end(su_reporter_t *r, const su_result_t *result) {
+    fprintf(
+        r->out,
+        "# pass %u fail %u skip %u timeout %u\n",
+        result->counts[SU_PASS],
+        result->counts[SU_FAIL],
+        result->counts[SU_SKIP],
+        result->counts[SU_TIMEOUT]
+    );
+}
+
+static const su_reporter_vtable_t SU_TAP_REPORTER = {
+    .begin = su_tap_begin,
+    .module_begin = su_tap_module_begin,
+    .test_end = su_tap_test_end,
+    .module_end = su_reporter_skip_module,
+    .end = su_tap_end,
+};
+
+static void
+su_junit_begin(su_reporter_t *r, size_t test_count) {
+    (void)test_count;
+    fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n", r->out);
+}
+
+static void
+su_junit_test_end(su_reporter_t *r, const su_test_t *test) {
+    (void)r;
+    (void)test;
+}
+
+/// Writes the `<failure>` or `<error>` of a test with its captured output as text.
+static void
+su_junit_problem(
+    su_reporter_t *r, const su_test_t *test, const char *element, const char *fallback
+) {
+    // the first message of the framework about the test, which start with its name
+    const char *message = NULL;
+    const size_t name_length = strlen(test->pretty_name);
+    for (const char *line = test->output; line && !message;) {
+        if (strncmp(line, test->pretty_name, name_length) == 0) {
+            message = line;
+        }
+        line = strchr(line, '\n');
+        line = line ? line + 1 : NULL;
+    }
+    fprintf(r->out, ">\n      <%s message=\"", element);
+    if (message) {
+        su_xml_escape(r->out, message, strcspn(message, "\n"));
+    } else {
+        fputs(fallback, r->out);
+    }
+    if (test->output && *test->output) {
+        fputs("\">", r->out);
+        su_xml_cdata(r->out, test->output);
+        fprintf(r->out, "</%s>\n    </testcase>\n", element);
+    } else {
+        fputs("\"/>\n    </testcase>\n", r->out);
+    }
+}
+
+// the counts are attributes of <testsuite>, so a module is written once it finished
+static void
+su_junit_module_end(su_reporter_t *r, const su_module_t *mod) {
+    fputs("  <testsuite name=\"", r->out);
+    su_xml_escape(r->out, mod->name, SIZE_MAX);
+    fprintf(
+        r->out,
+        "\" tests=\"%zu\" failures=\"%u\" errors=\"%u\" skipped=\"%u\" time=\"%.6f\">\n",
+        mod->test_count,
+        mod->counts[SU_FAIL],
+        mod->counts[SU_TIMEOUT],
+        mod->counts[SU_SKIP],
+        su_time_ms(mod->runtime) / 1000.0
+    );
+    for (size_t i = 0; i < mod->test_count; ++i) {
+        const su_test_t *test = mod->tests[i];
+        fputs("    <testcase classname=\"", r->out);
+        su_xml_escape(r->out, mod->name, SIZE_MAX);
+        fputs("\" name=\"", r->out);
+        su_xml_escape(r->out, test->name, SIZE_MAX);
+        fprintf(r->out, "\" time=\"%.6f\"", su_time_ms(test->runtime) / 1000.0);
+        if (test->bench && test->status == SU_PASS) {
+            su_bench_metric_t metrics[5 + SU_BENCH_METRICS];
+            const size_t count = su_bench_all_metrics(&test->bench->stats, metrics);
+            fputs(">\n      <properties>\n", r->out);
+            for (size_t j = 0; j < count; ++j) {
+                fputs("        <property name=\"", r->out);
+                su_xml_escape(r->out, metrics[j].name, SIZE_MAX);
+                fprintf(r->out, "\" value=\"%.6g\"/>\n", metrics[j].value);
+            }
+            fputs("      </properties>\n    </testcase>\n", r->out);
+            continue;
+        }
+        switch (test->status) {
+        case SU_PASS: fputs("/>\n", r->out); break;
+        case SU_FAIL: su_junit_problem(r, test, "failure", "failed"); break;
+        case SU_SKIP: fputs(">\n      <skipped/>\n    </testcase>\n", r->out); break;
+        case SU_TIMEOUT: su_junit_problem(r, test, "error", "timed out"); break;
+        }
+    }
+    fputs("  </testsuite>\n", r->out);
+}
+
+static void
+su_junit_end(su_reporter_t *r, const su_result_t *result) {
+    (void)result;
+    fputs("</testsuites>\n", r->out);
+}
+
+static const su_reporter_vtable_t SU_JUNIT_REPORTER = {
+    .begin = su_junit_begin,
+    .module_begin = su_reporter_skip_module,
+    .test_end = su_junit_test_end,
+    .module_end = su_junit_module_end,
+    .end = su_junit_end,
+};
+
+static const struct {
+    const char *name;
+    const su_reporter_vtable_t *vtable;
+} SU_REPORTERS[] = {
+    {"console", &SU_CONSOLE_REPORTER},
+    {"junit", &SU_JUNIT_REPORTER},
+    {"jsonl", &SU_JSONL_REPORTER},
+    {"tap", &SU_TAP_REPORTER},
+};
+
+const su_reporter_vtable_t *
+su_find_reporter(const char *name) {
+    for (size_t i = 0; i < sizeof(SU_REPORTERS) / sizeof(*SU_REPORTERS); ++i) {
+        if (strcmp(SU_REPORTERS[i].name, name) == 0) {
+            return SU_REPORTERS[i].vtable;
+        }
+    }
+    return NULL;
+}
+
+bool
+su_reporter_open(su_reporter_t *reporter, const su_options_t *options) {
+    // one large buffer instead of a write per line into the report file
+    static char buf[SU_REPORT_BUF_SIZE];
+    const su_reporter_vtable_t *vtable
+        = options->reporter ? su_find_reporter(options->reporter) : NULL;
+    *reporter = (su_reporter_t){
+        .vtable = vtable ? vtable : &SU_CONSOLE_REPORTER,
+        .out = stdout,
+        .timing = options->timing,
+    };
+    if (options->report_file) {
+        reporter->out = fopen(options->report_file, "w");
+        if (!reporter->out) {
+            perror(options->report_file);
+            reporter->out = stdout;
+            return false;
+        }
+        // stdout may have been used already, which rules out changing its buffer
+        setvbuf(reporter->out, buf, _IOFBF, sizeof(buf));
+    }
+    if (isatty(fileno(reporter->out))) {
+        const char *no_color = getenv("NO_COLOR");
+        reporter->color = !no_color || !*no_color;
+    }
+    return true;
+}
+
+void
+su_reporter_close(su_reporter_t *reporter) {
+    if (reporter->out != stdout) {
+        fclose(reporter->out);
+    } else {
+        fflush(stdout);
+    }
+    reporter->out = NULL;
+}
+
+// MARK: - Module
+
+static void
+su_get_rusage(struct rusage *usage) {
+#ifdef RUSAGE_THREAD
+    getrusage(RUSAGE_THREAD, usage);
+#else
+    getrusage(RUSAGE_SELF, usage);
+#endif
+}
+
+static su_usage_t
+su_usage_delta(const struct rusage *start, const struct rusage *end) {
+    return (su_usage_t){
+        .max_rss_kb = end->ru_maxrss - start->ru_maxrss,
+        .minor_faults = end->ru_minflt - start->ru_minflt,
+        .major_faults = end->ru_majflt - start->ru_majflt,
+        .voluntary_switches = end->ru_nvcsw - start->ru_nvcsw,
+        .involuntary_switches = end->ru_nivcsw - start->ru_nivcsw,
+    };
+}
+
+static void
+su_module_run_test_body(su_module_t *mod, void *object, su_test_t *test) {
+    if (test->bench) {
+        su_bench_run(mod, object, test);
+    } else {
+        mod->vtable->run(mod, object, test);
+    }
+}
+
+static void
+su_module_run_test_with_timeout(su_module_t *mod, void *object, su_test_t *test, uint32_t ms) {
+    if (sigsetjmp(su__timeout_jmp, 1)) {
+        su_kill_children();
+        su_subproc_release();
+        test->status = SU_TIMEOUT;
+        printf("%s: timed out after %ums\n", test->pretty_name, ms);
+        if (!atomic_exchange(&su__poisoned, true) && su__threaded) {
+            fputs(
+                "the remaining tests share the process of the timed out test and may deadlock on "
+                "locks it held, use --jobs to isolate them\n",
+                stderr
+            );
+        }
+        return;
+    }
+    su_timeout_arm(ms);
+    su_module_run_test_body(mod, object, test);
+    su_timeout_disarm();
+}
+
+// Captured output goes into a memfd of a fixed size sealed against growing, so writes past
+// `SU_CAPTURE_LIMIT` fail right away instead of being stored.  Stdout and stderr share the file
+// (and its offset) which keeps them interleaved, the offset is the amount of captured output.
+
+static int su__capture_fd = -1;
+/// Workers must not share the file offset with their parent.
+static pid_t su__capture_pid;
+
+static bool
+su_capture_begin(int saved[2]) {
+    if (su__capture_pid != getpid()) {
+        su__capture_pid = getpid();
+        su__capture_fd = memfd_create("smallunit-capture", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (su__capture_fd == -1 || ftruncate(su__capture_fd, SU_CAPTURE_LIMIT) == -1
+            || fcntl(su__capture_fd, F_ADD_SEALS, F_SEAL_GROW) == -1) {
+            perror("memfd_create");
+            if (su__capture_fd != -1) {
+                close(su__capture_fd);
+                su__capture_fd = -1;
+            }
+        }
+    }
+    if (su__capture_fd == -1) {
+        return false;
+    }
+    // only the redirected streams, flushing all would also write out a buffered report file
+    fflush(stdout);
+    fflush(stderr);
+    lseek(su__capture_fd, 0, SEEK_SET);
+    saved[0] = dup(STDOUT_FILENO);
+    saved[1] = dup(STDERR_FILENO);
+    dup2(su__capture_fd, STDOUT_FILENO);
+    dup2(su__capture_fd, STDERR_FILENO);
+    return true;
+}
+
+/// Restores the streams, with `replay` prints the output and keeps it in `output`.
+static void
+su_capture_end(const int saved[2], bool replay, char **output) {
+    fflush(stdout);
+    fflush(stderr);
+    // writes past the limit failed
+    clearerr(stdout);
+    clearerr(stderr);
+    const off_t size = lseek(su__capture_fd, 0, SEEK_CUR);
+    dup2(saved[0], STDOUT_FILENO);
+    dup2(saved[1], STDERR_FILENO);
+    close(saved[0]);
+    close(saved[1]);
+    if (!replay) {
+        return;
+    }
+    char buf[65536];
+    char last = '\n';
+    for (off_t offset = 0; offset < size;) {
+        const size_t remaining = size - offset;
+        const ssize_t n = pread(
+            su__capture_fd, buf, remaining < sizeof(buf) ? remaining : sizeof(buf), offset
+        );
+        if (n <= 0 || !su_write_all(STDOUT_FILENO, buf, n)) {
+            break;
+        }
+        memcpy(arraddnptr(*output, n), buf, n);
+        last = buf[n - 1];
+        offset += n;
+    }
+    arrput(*output, '\0');
+    if (size >= SU_CAPTURE_LIMIT) {
+        printf("%s[output truncated after %d bytes]\n", last == '\n' ? "" : "\n", SU_CAPTURE_LIMIT);
+    }
+}
+
+void
+su_module_run_test(su_module_t *mod, void *object, su_test_t *test) {
+    int saved[2];
+    const bool capture = su__state.options.capture && su_capture_begin(saved);
+    struct rusage usage_start, usage_end;
+    test->status = SU_PASS;
+    su__current_test = test;
+    su_get_rusage(&usage_start);
+    const su_time_t cpu_start = su_time_now(CLOCK_THREAD_CPUTIME_ID);
+    const su_time_t start = su_time_now(CLOCK_MONOTONIC);
+    const uint32_t timeout_ms = test->timeout_ms ? test->timeout_ms : su__state.options.timeout_ms;
+    if (su__state.options.counters) {
+        su_counters_begin(test);
+    }
+    if (su__state.options.profile_dir) {
+        su_profile_begin();
+    }
+    su_alloc_tracking_begin();
+    if (timeout_ms) {
+        su_module_run_test_with_timeout(mod, object, test, timeout_ms);
+    } else {
+        su_module_run_test_body(mod, object, test);
+    }
+    test->allocs = su_alloc_tracking_end();
+    su_profile_end();
+    test->counters = su_counters_end();
+    su_failure_summary(test);
+    const su_time_t end = su_time_now(CLOCK_MONOTONIC);
+    const su_time_t cpu_end = su_time_now(CLOCK_THREAD_CPUTIME_ID);
+    su_get_rusage(&usage_end);
+    su__current_test = NULL;
+    if (su__trace_fd != -1) {
+        char args[32];
+        snprintf(args, sizeof(args), "\"status\":\"%s\"", SU_STATUS_NAMES[test->status]);
+        su_trace_span("test", test->pretty_name, start, end, args);
+    }
+    test->runtime = su_time_sub(end, start);
+    test->cpu_time = su_time_sub(cpu_end, cpu_start);
+    test->usage = su_usage_delta(&usage_start, &usage_end);
+    if (capture) {
+        arrfree(test->output);
+        su_capture_end(
+            saved, test->status == SU_FAIL || test->status == SU_TIMEOUT, &test->output
+        );
+    }
+    // failed tests return early and routinely leak, only passing ones are reported
+    if (test->allocs.live > 0 && test->status == SU_PASS) {
+        fprintf(stderr, "%s: %ld bytes not freed\n", test->pretty_name, (long)test->allocs.live);
+    }
+    if (su__state.options.profile_dir) {
+        su_profile_write(su__state.options.profile_dir, test);
+    }
+}
+
+static void
+su_module_count_test(su_module_t *mod, const su_test_t *test) {
+    ++mod->counts[test->status];
+    mod->runtime = su_time_add(mod->runtime, test->runtime);
+}
+
+/// Frees the output kept for the report of the module.
+static void
+su_module_free_output(const su_module_t *mod) {
+    for (size_t i = 0; i < mod->test_count; ++i) {
+        arrfree(mod->tests[i]->output);
+    }
+}
+
+void
+su_module_run(su_module_t *mod, su_reporter_t *reporter) {
+    const su_time_t start = su_trace_now();
+    reporter->vtable->module_begin(reporter, mod);
+    memset(mod->counts, 0, sizeof(mod->counts));
+    mod->runtime = (su_time_t){0};
+    void *object = mod->vtable->init(mod);
+    for (size_t i = 0; i < mod->test_count; ++i) {
+        su_test_t *test = mod->tests[i];
+        su_module_run_test(mod, object, test);
+        su_module_count_test(mod, test);
+        reporter->vtable->test_end(reporter, test);
+    }
+    mod->vtable->clean(mod, object);
+    su_trace_end("module", mod->name, start, NULL);
+    reporter->vtable->module_end(reporter, mod);
+    su_module_free_output(mod);
+}
+
+static void *
+su_noop_init(void *_) {
+    (void)_;
+    return NULL;
+}
+
+static void
+su_noop_clean(void *_, void *__) {
+    (void)_;
+    (void)__;
+}
+
+static void
+su_run_stateless_test(void *_, void *__, su_test_t *test) {
+    (void)_;
+    (void)__;
+    ((su_stateless_test_fn_t)test->fn)(test);
+}
+
+static const su_module_vtable_t SU_MODULE_VTABLE = {
+    .init = su_noop_init,
+    .clean = su_noop_clean,
+    .run = su_run_stateless_test,
+};
+
+static void *
+su_fixture_owner_init(void *p_self) {
+    su_fixture_owner_t *self = p_self;
+    const su_time_t start = su_trace_now();
+    void *fixture = calloc(1, self->object_size);
+    self->setup(fixture);
+    su_trace_fixture("setup", &self->mod, start);
+    return fixture;
+}
+
+static void
+su_fixture_owner_clean(void *p_self, void *fixture) {
+    su_fixture_owner_t *self = p_self;
+    const su_time_t start = su_trace_now();
+    self->tear_down(fixture);
+    free(fixture);
+    su_trace_fixture("tear_down", &self->mod, start);
+}
+
+static void
+su_run_fixture_test(void *_, void *fixture, su_test_t *test) {
+    (void)_;
+    ((su_fixture_test_fn_t)test->fn)(test, fixture);
+}
+
+static const su_module_vtable_t SU_FIXTURE_OWNER_VTABLE = {
+    .init = su_fixture_owner_init,
+    .clean = su_fixture_owner_clean,
+    .run = su_run_fixture_test,
+};
+
+// snapshot mode objects hold the snapshot followed by the object the tests work on
+
+static void *
+su_fixture_snapshot_init(void *p_self) {
+    su_fixture_owner_t *self = p_self;
+    const su_time_t start = su_trace_now();
+    void *snapshot = calloc(2, self->object_size);
+    self->setup(snapshot);
+    su_trace_fixture("setup", &self->mod, start);
+    return snapshot;
+}
+
+static void
+su_fixture_snapshot_clean(void *p_self, void *snapshot) {
+    su_fixture_owner_t *self = p_self;
+    const su_time_t start = su_trace_now();
+    self->tear_down(snapshot);
+    free(snapshot);
+    su_trace_fixture("tear_down", &self->mod, start);
+}
+
+static void
+su_run_fixture_snapshot_test(void *p_self, void *snapshot, su_test_t *test) {
+    su_fixture_owner_t *self = p_self;
+    void *fixture = (char *)snapshot + self->object_size;
+    if (self->clone) {
+        su_framework_allocs();
+        const su_time_t start = su_trace_now();
+        memset(fixture, 0, self->object_size);
+        self->clone(fixture, snapshot);
+        su_trace_fixture("clone", &self->mod, start);
+    } else {
+        memcpy(fixture, snapshot, self->object_size);
+    }
+    ((su_fixture_test_fn_t)test->fn)(test, fixture);
+    if (self->clone) {
+        su_framework_allocs();
+        const su_time_t start = su_trace_now();
+        self->tear_down(fixture);
+        su_trace_fixture("tear_down", &self->mod, start);
+    }
+}
+
+static const su_module_vtable_t SU_FIXTURE_SNAPSHOT_VTABLE = {
+    .init = su_fixture_snapshot_init,
+    .clean = su_fixture_snapshot_clean,
+    .run = su_run_fixture_snapshot_test,
+};
+
+typedef struct {
+    su_status_t status;
+    // benchmarks measure inside the child
+    su_time_t bench_elapsed;
+    bool bench_measured;
+    su_complexity_t bench_complexity;
+    su_bench_throughput_t bench_throughput;
+    su_alloc_stats_t allocs;
+} su_fork_result_t;
+
+static void
+su_run_fixture_fork_test(void *_, void *fixture, su_test_t *test) {
+    (void)_;
+    int p[2];
+    if (pipe(p) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(NULL);
+    const su_time_t start = su_trace_now();
+    const int pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    } else if (pid == 0) {
+        su__timeout_armed = false;
+        su__counting = false;
+        close(p[0]);
+        ((su_fixture_test_fn_t)test->fn)(test, fixture);
+        su_failure_summary(test);
+        fflush(stdout);
+        fflush(stderr);
+        su_fork_result_t result = {.status = test->status, .allocs = su_alloc_stats()};
+        if (test->bench) {
+            result.bench_elapsed = test->bench->elapsed;
+            result.bench_measured = test->bench->measured;
+            result.bench_complexity = test->bench->expected_complexity;
+            result.bench_throughput = test->bench->call;
+        }
+        _exit(su_write_all(p[1], &result, sizeof(result)) ? 0 : 1);
+    }
+    close(p[1]);
+    su_framework_allocs();
+    su_track_child(pid);
+    su_fork_result_t result;
+    const bool received = su_read_all(p[0], &result, sizeof(result));
+    close(p[0]);
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    su_untrack_child(pid);
+    su_trace_child("fork", pid, start);
+    if (!received) {
+        char buf[32];
+        const char *description = su_describe_status(status, buf, sizeof(buf));
+        fprintf(stderr, "%s: test process crashed: %s\n", test->pretty_name, description);
+        test->status = SU_FAIL;
+        return;
+    }
+    test->status = result.status;
+    // the child started from our counts
+    su_alloc_stats_restore(result.allocs);
+    if (test->bench) {
+        test->bench->elapsed = result.bench_elapsed;
+        test->bench->measured = result.bench_measured;
+        test->bench->expected_complexity = result.bench_complexity;
+        test->bench->call = result.bench_throughput;
+    }
+}
+
+static const su_module_vtable_t SU_FIXTURE_FORK_VTABLE = {
+    .init = su_fixture_owner_init,
+    .clean = su_fixture_owner_clean,
+    .run = su_run_fixture_fork_test,
+};
+
+static const su_module_vtable_t *SU_FIXTURE_VTABLES[] = {
+    [SU_FIXTURE_SHARED] = &SU_FIXTURE_OWNER_VTABLE,
+    [SU_FIXTURE_SNAPSHOT] = &SU_FIXTURE_SNAPSHOT_VTABLE,
+    [SU_FIXTURE_FORK] = &SU_FIXTURE_FORK_VTABLE,
+};
+
+// MARK: - Workers
+
+// A worker is a forked process that receives modules over `task_tx` and runs them with
+// stdout and stderr redirected into temporary files.  Once a module finishes the worker sends a
+// `su_worker_report_t` followed by one `su_worker_test_report_t` per test and the captured
+// output back over `report_rx`.
+
+typedef struct {
+    uint64_t module;
+    /// Index of the first test inside the module.
+    uint64_t first;
+    uint64_t test_count;
+    su_count_t counts[SU_STATUS_COUNT];
+    su_time_t runtime;
+    uint64_t out_size;
+    uint64_t err_size;
+    /// A test timed out and the worker exits after this report.
+    bool poisoned;
+} su_worker_report_t;
+
+typedef struct {
+    su_status_t status;
+    su_time_t runtime;
+    su_time_t cpu_time;
+    su_usage_t usage;
+    su_counters_t counters;
+    su_alloc_stats_t allocs;
+    su_bench_stats_t bench;
+    // end offsets of the output of this test
+    uint64_t out_end;
+    uint64_t err_end;
+} su_worker_test_report_t;
+
+typedef struct {
+    int pid;
+    int task_tx;
+    int report_rx;
+    // the module being run or NULL if idle
+    su_module_t *module;
+} su_worker_t;
+
+typedef struct {
+    bool done;
+    /// Tests received so far, after a timeout the module continues from here in a new worker.
+    size_t reported;
+    su_worker_test_report_t *tests;
+    /// Output of all tests so far (stb arrays).
+    char *out;
+    char *err;
+} su_module_report_t;
+
+static bool
+su_copy_fd(int from, uint64_t size, int to) {
+    char buf[16384];
+    uint64_t offset = 0;
+    while (offset < size) {
+        const size_t chunk = size - offset < sizeof(buf) ? size - offset : sizeof(buf);
+        const ssize_t n = pread(from, buf, chunk, offset);
+        if (n <= 0 || !su_write_all(to, buf, n)) {
+            return false;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+static uint64_t
+su_fd_offset(int fd) {
+    const off_t offset = lseek(fd, 0, SEEK_CUR);
+    return offset < 0 ? 0 : offset;
+}
+
+static void
+su_fd_rewind(int fd) {
+    if (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        perror("ftruncate");
+        _exit(1);
+    }
+}
+
+static bool
+su_worker_run_module(su_module_t *mod, size_t first, int report_tx) {
+    const size_t test_count = mod->test_count - first;
+    su_worker_test_report_t *tests = calloc(test_count ? test_count : 1, sizeof(*tests));
+    su_fd_rewind(STDOUT_FILENO);
+    su_fd_rewind(STDERR_FILENO);
+    memset(mod->counts, 0, sizeof(mod->counts));
+    mod->runtime = (su_time_t){0};
+    const su_time_t start = su_trace_now();
+    void *object = mod->vtable->init(mod);
+    size_t run = 0;
+    while (run < test_count && !su__poisoned) {
+        su_test_t *test = mod->tests[first + run];
+        su_module_run_test(mod, object, test);
+        su_module_count_test(mod, test);
+        fflush(stdout);
+        fflush(stderr);
+        tests[run++] = (su_worker_test_report_t){
+            .status = test->status,
+            .runtime = test->runtime,
+            .cpu_time = test->cpu_time,
+            .usage = test->usage,
+            .counters = test->counters,
+            .allocs = test->allocs,
+            .bench = test->bench ? test->bench->stats : (su_bench_stats_t){0},
+            .out_end = su_fd_offset(STDOUT_FILENO),
+            .err_end = su_fd_offset(STDERR_FILENO),
+        };
+    }
+    // after a timeout the rest of the module, even its tear down, is left to a new worker
+    if (!su__poisoned) {
+        mod->vtable->clean(mod, object);
+        su_trace_end("module", mod->name, start, NULL);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    su_worker_report_t report = {
+        .module = mod->index,
+        .first = first,
+        .test_count = run,
+        .runtime = mod->runtime,
+        .out_size = run ? tests[run - 1].out_end : 0,
+        .err_size = run ? tests[run - 1].err_end : 0,
+        .poisoned = su__poisoned,
+    };
+    memcpy(report.counts, mod->counts, sizeof(report.counts));
+    const bool ok = su_write_all(report_tx, &report, sizeof(report))
+                 && su_write_all(report_tx, tests, run * sizeof(*tests))
+                 && su_copy_fd(STDOUT_FILENO, report.out_size, report_tx)
+                 && su_copy_fd(STDERR_FILENO, report.err_size, report_tx);
+    free(tests);
+    return ok;
+}
+
+static void
+su_worker_main(su_state_t *state, int task_rx, int report_tx) {
+    signal(SIGPIPE, SIG_DFL);
+    FILE *out = tmpfile();
+    FILE *err = tmpfile();
+    if (!out || !err) {
+        perror("tmpfile");
+        _exit(1);
+    }
+    dup2(fileno(out), STDOUT_FILENO);
+    dup2(fileno(err), STDERR_FILENO);
+    // tasks are the index of the first test to run, the rest of its module follows
+    uint64_t first_test;
+    while (su_read_all(task_rx, &first_test, sizeof(first_test))) {
+        su_module_t *mod = state->tests[first_test]->module;
+        const size_t first = state->tests + first_test - mod->tests;
+        if (!su_worker_run_module(mod, first, report_tx)) {
+            _exit(1);
+        }
+        if (su__poisoned) {
+            _exit(0);
+        }
+    }
+    _exit(0);
+}
+
+static void
+su_worker_spawn(su_state_t *state, su_worker_t *workers, size_t count, su_worker_t *worker) {
+    int task[2], report[2];
+    if (pipe(task) == -1 || pipe(report) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    // the child must not inherit and later flush output buffered in the parent
+    fflush(stdout);
+    fflush(stderr);
+    const int pid = fork();
+    switch (pid) {
+    case -1: perror("fork"); exit(1);
+
+    case 0:
+        // other workers must see EOF on their task pipe once we close it in the parent
+        for (size_t i = 0; i < count; ++i) {
+            if (workers[i].pid > 0) {
+                close(workers[i].task_tx);
+                close(workers[i].report_rx);
+            }
+        }
+        close(task[1]);
+        close(report[0]);
+        su_trace_name("process_name", "worker", worker - workers);
+        su_worker_main(state, task[0], report[1]);
+        break;
+
+    default:
+        close(task[0]);
+        close(report[1]);
+        *worker = (su_worker_t){
+            .pid = pid,
+            .task_tx = task[1],
+            .report_rx = report[0],
+            .module = NULL,
+        };
+        break;
+    }
+}
+
+static void
+su_worker_reap(su_worker_t *worker, int *status) {
+    close(worker->task_tx);
+    close(worker->report_rx);
+    while (waitpid(worker->pid, status, 0) == -1 && errno == EINTR) {
+    }
+    worker->pid = 0;
+}
+
+/// Sends the next module to the worker, or tells it to exit once there is none.  A worker that
+/// died while idle is replaced once, if that one dies as well the worker is gone.
+static void
+su_worker_assign(
+    su_state_t *state,
+    su_worker_t *workers,
+    size_t count,
+    su_worker_t *worker,
+    const su_module_report_t *reports,
+    su_module_t **next_module
+) {
+    worker->module = NULL;
+    if (!*next_module) {
+        close(worker->task_tx);
+        worker->task_tx = -1;
+        return;
+    }
+    su_module_t *mod = *next_module;
+    const uint64_t first_test = mod->tests + reports[mod->index].reported - state->tests;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (su_write_all(worker->task_tx, &first_test, sizeof(first_test))) {
+            worker->module = mod;
+            *next_module = mod->next;
+            return;
+        }
+        int status;
+        su_worker_reap(worker, &status);
+        if (attempt == 0) {
+            su_worker_spawn(state, workers, count, worker);
+        }
+    }
+}
+
+/// Receives the report of `worker`, `poisoned` is set if the worker exits afterwards.
+static bool
+su_worker_receive(su_worker_t *worker, su_module_report_t *reports, bool *poisoned) {
+    su_module_t *mod = worker->module;
+    su_module_report_t *result = &reports[mod->index];
+    su_worker_report_t report;
+    if (!su_read_all(worker->report_rx, &report, sizeof(report)) || report.module != mod->index
+        || report.first != result->reported || report.test_count > mod->test_count - report.first) {
+        return false;
+    }
+    if (!result->tests) {
+        result->tests = calloc(mod->test_count ? mod->test_count : 1, sizeof(*result->tests));
+    }
+    su_worker_test_report_t *tests = result->tests + report.first;
+    // the output of a module continued in another worker follows that of the first
+    const uint64_t out_base = arrlen(result->out);
+    const uint64_t err_base = arrlen(result->err);
+    char *out = arraddnptr(result->out, report.out_size);
+    char *err = arraddnptr(result->err, report.err_size);
+    if (!su_read_all(worker->report_rx, tests, report.test_count * sizeof(*tests))
+        || !su_read_all(worker->report_rx, out, report.out_size)
+        || !su_read_all(worker->report_rx, err, report.err_size)) {
+        // keep only the complete output of earlier workers
+        if (result->out) {
+            arrsetlen(result->out, out_base);
+        }
+        if (result->err) {
+            arrsetlen(result->err, err_base);
+        }
+        return false;
+    }
+    if (!report.first) {
+        memset(mod->counts, 0, sizeof(mod->counts));
+        mod->runtime = (su_time_t){0};
+    }
+    for (size_t i = 0; i < report.test_count; ++i) {
+        su_test_t *test = mod->tests[report.first + i];
+        tests[i].out_end += out_base;
+        tests[i].err_end += err_base;
+        test->status = tests[i].status;
+        test->runtime = tests[i].runtime;
+        test->cpu_time = tests[i].cpu_time;
+        test->usage = tests[i].usage;
+        test->counters = tests[i].counters;
+        test->allocs = tests[i].allocs;
+        if (test->bench) {
+            test->bench->stats = tests[i].bench;
+        }
+    }
+    for (int status = 0; status < SU_STATUS_COUNT; ++status) {
+        mod->counts[status] += report.counts[status];
+    }
+    mod->runtime = su_time_add(mod->runtime, report.runtime);
+    result->reported += report.test_count;
+    result->done = result->reported == mod->test_count;
+    *poisoned = report.poisoned;
+    return true;
+}
+
+/// Fails the tests of a module no worker reported, `message` is printed after them.
+static void
+su_module_report_failed(su_module_t *mod, su_module_report_t *reports, const char *message) {
+    su_module_report_t *result = &reports[mod->index];
+    if (!result->tests) {
+        result->tests = calloc(mod->test_count ? mod->test_count : 1, sizeof(*result->tests));
+    }
+    if (!result->reported) {
+        memset(mod->counts, 0, sizeof(mod->counts));
+        mod->runtime = (su_time_t){0};
+    }
+    for (size_t i = result->reported; i < mod->test_count; ++i) {
+        su_test_t *test = mod->tests[i];
+        test->status = SU_FAIL;
+        test->runtime = (su_time_t){0};
+        test->cpu_time = (su_time_t){0};
+        test->usage = (su_usage_t){0};
+        test->counters = (su_counters_t){0};
+        test->allocs = (su_alloc_stats_t){0};
+        su_module_count_test(mod, test);
+        result->tests[i] = (su_worker_test_report_t){
+            .status = SU_FAIL,
+            .out_end = arrlen(result->out),
+            .err_end = arrlen(result->err),
+        };
+    }
+    const size_t length = strlen(message);
+    memcpy(arraddnptr(result->err, length), message, length);
+    result->reported = mod->test_count;
+    result->done = true;
+}
+
+static void
+su_worker_crashed(su_worker_t *worker, su_module_report_t *reports) {
+    su_module_t *mod = worker->module;
+    int status = 0;
+    su_worker_reap(worker, &status);
+    char buf[32];
+    const char *description = su_describe_status(status, buf, sizeof(buf));
+    char *message = NULL;
+    if (asprintf(&message, "worker running %s crashed: %s\n", mod->name, description) != -1) {
+        su_module_report_failed(mod, reports, message);
+        free(message);
+    }
+}
+
+static void
+su_module_print_report(
+    const su_module_t *mod,
+    const su_module_report_t *report,
+    su_reporter_t *reporter
+) {
+    reporter->vtable->module_begin(reporter, mod);
+    uint64_t out_pos = 0;
+    uint64_t err_pos = 0;
+    for (size_t i = 0; i < mod->test_count; ++i) {
+        const su_worker_test_report_t *test = &report->tests[i];
+        if (test->status == SU_FAIL || test->status == SU_TIMEOUT) {
+            char **output = &mod->tests[i]->output;
+            const uint64_t out_size = test->out_end > out_pos ? test->out_end - out_pos : 0;
+            const uint64_t err_size = test->err_end > err_pos ? test->err_end - err_pos : 0;
+            if (out_size) {
+                memcpy(arraddnptr(*output, out_size), report->out + out_pos, out_size);
+            }
+            if (err_size) {
+                memcpy(arraddnptr(*output, err_size), report->err + err_pos, err_size);
+            }
+            arrput(*output, '\0');
+        }
+        if (test->out_end > out_pos) {
+            fwrite(report->out + out_pos, 1, test->out_end - out_pos, stdout);
+            out_pos = test->out_end;
+        }
+        if (test->err_end > err_pos) {
+            fflush(stdout);
+            fwrite(report->err + err_pos, 1, test->err_end - err_pos, stderr);
+            err_pos = test->err_end;
+        }
+        reporter->vtable->test_end(reporter, mod->tests[i]);
+    }
+    // output after the last test: the module's tear down, or why the module failed
+    if (arrlen(report->out) > (ptrdiff_t)out_pos) {
+        fwrite(report->out + out_pos, 1, arrlen(report->out) - out_pos, stdout);
+    }
+    if (arrlen(report->err) > (ptrdiff_t)err_pos) {
+        fflush(stdout);
+        fwrite(report->err + err_pos, 1, arrlen(report->err) - err_pos, stderr);
+    }
+    reporter->vtable->module_end(reporter, mod);
+    su_module_free_output(mod);
+}
+
+/// Runs all modules of the state in `jobs` worker processes, printing the results of each module
+/// in declaration order.
+static void
+su_state_run_parallel(su_state_t *state) {
+    const size_t module_count = state->module_count;
+    const size_t worker_count
+        = state->options.jobs < module_count ? state->options.jobs : module_count;
+    su_worker_t *workers = calloc(worker_count, sizeof(*workers));
+    su_module_report_t *reports = calloc(module_count, sizeof(*reports));
+    struct pollfd *fds = calloc(worker_count, sizeof(*fds));
+    size_t *fd_workers = calloc(worker_count, sizeof(*fd_workers));
+    su_module_t *next_module = state->modules;
+    su_module_t *next_print = state->modules;
+    void (*old_sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+    fflush(NULL);
+    for (size_t i = 0; i < worker_count; ++i) {
+        su_worker_spawn(state, workers, worker_count, &workers[i]);
+        su_worker_assign(state, workers, worker_count, &workers[i], reports, &next_module);
+    }
+    while (next_print) {
+        nfds_t nfds = 0;
+        for (size_t i = 0; i < worker_count; ++i) {
+            if (workers[i].module) {
+                fds[nfds] = (struct pollfd){.fd = workers[i].report_rx, .events = POLLIN};
+                fd_workers[nfds++] = i;
+            }
+        }
+        // with modules left but no worker running one all workers are gone
+        for (su_module_t *mod = next_print; !nfds && mod; mod = mod->next) {
+            if (!reports[mod->index].done) {
+                char message[256];
+                snprintf(message, sizeof(message), "no worker left to run %s\n", mod->name);
+                su_module_report_failed(mod, reports, message);
+            }
+        }
+        next_module = nfds ? next_module : NULL;
+        if (nfds && poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+        for (nfds_t i = 0; i < nfds; ++i) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            su_worker_t *worker = &workers[fd_workers[i]];
+            su_module_t *resume = NULL;
+            bool poisoned = false;
+            if (!su_worker_receive(worker, reports, &poisoned)) {
+                su_worker_crashed(worker, reports);
+                su_worker_spawn(state, workers, worker_count, worker);
+            } else if (poisoned) {
+                // the worker stopped after a timeout, the rest of its module goes to a new one
+                resume = reports[worker->module->index].done ? NULL : worker->module;
+                int status;
+                su_worker_reap(worker, &status);
+                su_worker_spawn(state, workers, worker_count, worker);
+            }
+            su_worker_assign(
+                state, workers, worker_count, worker, reports, resume ? &resume : &next_module
+            );
+        }
+        while (next_print && reports[next_print->index].done) {
+            su_module_report_t *report = &reports[next_print->index];
+            su_module_print_report(next_print, report, &state->reporter);
+            free(report->tests);
+            arrfree(report->out);
+            arrfree(report->err);
+            next_print = next_print->next;
+        }
+    }
+    for (size_t i = 0; i < worker_count; ++i) {
+        int status;
+        if (workers[i].pid > 0) {
+            su_worker_reap(&workers[i], &status);
+        }
+    }
+    signal(SIGPIPE, old_sigpipe);
+    free(fd_workers);
+    free(fds);
+    free(reports);
+    free(workers);
+}
+
+// MARK: - Threads
+
+// The tests of the state are split into contiguous ranges, one per thread.  A thread runs tests
+// from the front of its own range and once that is empty steals the back half of another
+// thread's range.  Both ends of a range live in a single atomic word so popping and stealing are
+// a compare-and-swap each.  Every thread lazily creates its own
+// module objects (fixtures) and results are only written to the tests themselves, counts are
+// aggregated after all threads finished.
+
+typedef struct {
+    // head in the low, tail in the high 32 bits
+    _Atomic uint64_t range;
+    // keep the ranges of different threads on separate cache lines
+    char _padding[64 - sizeof(uint64_t)];
+} su_deque_t;
+
+typedef struct {
+    su_state_t *state;
+    su_deque_t *deques;
+    /// Indices into the tests of the state, the deques hold positions in this.
+    const uint32_t *tasks;
+    size_t thread_count;
+    size_t index;
+} su_thread_t;
+
+static uint64_t
+su_deque_pack(uint32_t head, uint32_t tail) {
+    return (uint64_t)tail << 32 | head;
+}
+
+static bool
+su_deque_pop(su_deque_t *deque, uint32_t *task) {
+    uint64_t range = atomic_load_explicit(&deque->range, memory_order_acquire);
+    for (;;) {
+        const uint32_t head = (uint32_t)range;
+        const uint32_t tail = (uint32_t)(range >> 32);
+        if (head >= tail) {
+            return false;
+        }
+        if (atomic_compare_exchange_weak_explicit(
+                &deque->range,
+                &range,
+                su_deque_pack(head + 1, tail),
+                memory_order_acq_rel,
+                memory_order_acquire
+            )) {
+            *task = head;
+            return true;
+        }
     }
 }
 
-static char *
-su_describe_status(int status) {
-    char *result;
-    if (WIFEXITED(status)) {
-        const int code = WEXITSTATUS(status);
-        if (code == 0) {
-            result = strdup("exited normally");
+/// Moves the back half of `victim` into the (empty) deque `thief`.
+static bool
+su_deque_steal(su_deque_t *victim, su_deque_t *thief) {
+    uint64_t range = atomic_load_explicit(&victim->range, memory_order_acquire);
+    for (;;) {
+        const uint32_t head = (uint32_t)range;
+        const uint32_t tail = (uint32_t)(range >> 32);
+        if (head >= tail) {
+            return false;
+        }
+        const uint32_t split = tail - (tail - head + 1) / 2;
+        if (atomic_compare_exchange_weak_explicit(
+                &victim->range,
+                &range,
+                su_deque_pack(head, split),
+                memory_order_acq_rel,
+                memory_order_acquire
+            )) {
+            atomic_store_explicit(&thief->range, su_deque_pack(split, tail), memory_order_release);
+            return true;
+        }
+    }
+}
+
+static void *
+su_thread_main(void *p_self) {
+    su_thread_t *self = p_self;
+    su_state_t *state = self->state;
+    const size_t module_count = state->module_count;
+    void **objects = calloc(module_count, sizeof(*objects));
+    bool *initialized = calloc(module_count, sizeof(*initialized));
+    su_deque_t *own = &self->deques[self->index];
+    su_trace_name("thread_name", "thread", self->index);
+    for (;;) {
+        uint32_t index;
+        if (!su_deque_pop(own, &index)) {
+            bool stolen = false;
+            for (size_t i = 1; i < self->thread_count && !stolen; ++i) {
+                su_deque_t *victim = &self->deques[(self->index + i) % self->thread_count];
+                stolen = su_deque_steal(victim, own);
+            }
+            if (stolen) {
+                continue;
+            }
+            break;
+        }
+        su_test_t *test = state->tests[self->tasks[index]];
+        su_module_t *mod = test->module;
+        if (!initialized[mod->index]) {
+            objects[mod->index] = mod->vtable->init(mod);
+            initialized[mod->index] = true;
+        }
+        su_module_run_test(mod, objects[mod->index], test);
+    }
+    for (su_module_t *mod = state->modules; mod; mod = mod->next) {
+        if (initialized[mod->index]) {
+            mod->vtable->clean(mod, objects[mod->index]);
+        }
+    }
+    su_timeout_release();
+    su_regex_release();
+    su_counters_close();
+    su_profile_release();
+    free(initialized);
+    free(objects);
+    return NULL;
+}
+
+/// Runs all tests of the state on `threads` threads and prints the results in declaration order
+/// once all of them finished.
+static void
+su_state_run_threaded(su_state_t *state) {
+    if (state->options.capture) {
+        // all threads share stdout and stderr
+        fputs("--capture is ignored when using multiple threads\n", stderr);
+        state->options.capture = false;
+    }
+    su__threaded = true;
+    const size_t task_count = state->test_count;
+    const size_t thread_count = state->options.threads;
+    su_deque_t *deques = aligned_alloc(64, thread_count * sizeof(*deques));
+    su_thread_t *threads = calloc(thread_count, sizeof(*threads));
+    pthread_t *handles = calloc(thread_count, sizeof(*handles));
+    uint32_t *tasks = malloc((task_count + 1) * sizeof(*tasks));
+    for (size_t i = 0, next = 0; i < thread_count; ++i) {
+        const uint32_t head = next;
+        if (state->thread_order) {
+            // the scheduled order is dealt out so every thread starts with its longest tests
+            for (size_t j = i; j < task_count; j += thread_count) {
+                tasks[next++] = state->thread_order[j];
+            }
         } else {
-            asprintf(&result, "code(%d)", code);
+            for (; next < task_count * (i + 1) / thread_count; ++next) {
+                tasks[next] = next;
+            }
         }
-    } else if (WIFSIGNALED(status)) {
-        const int signal = WTERMSIG(status);
-        asprintf(&result, "signal(%d)", signal);
-    } else {
-        result = strdup("unknown");
+        atomic_init(&deques[i].range, su_deque_pack(head, next));
+        threads[i] = (su_thread_t){
+            .state = state,
+            .deques = deques,
+            .tasks = tasks,
+            .thread_count = thread_count,
+            .index = i,
+        };
     }
-    return result;
+    fflush(stdout);
+    // the calling thread works as well
+    for (size_t i = 1; i < thread_count; ++i) {
+        if (pthread_create(&handles[i], NULL, su_thread_main, &threads[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    su_thread_main(&threads[0]);
+    for (size_t i = 1; i < thread_count; ++i) {
+        pthread_join(handles[i], NULL);
+    }
+    su_reporter_t *reporter = &state->reporter;
+    for (su_module_t *mod = state->modules; mod; mod = mod->next) {
+        reporter->vtable->module_begin(reporter, mod);
+        memset(mod->counts, 0, sizeof(mod->counts));
+        mod->runtime = (su_time_t){0};
+        for (size_t i = 0; i < mod->test_count; ++i) {
+            su_module_count_test(mod, mod->tests[i]);
+            reporter->vtable->test_end(reporter, mod->tests[i]);
+        }
+        reporter->vtable->module_end(reporter, mod);
+    }
+    free(handles);
+    free(threads);
+    free(deques);
+    free(tasks);
+    free(state->thread_order);
+    state->thread_order = NULL;
+}
+
+// MARK: - History
+
+static const char SU_HISTORY_MAGIC[8] = "SUHIST2";
+
+static uint64_t
+su_hash_name(const char *name) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (; *name; ++name) {
+        hash = (hash ^ (unsigned char)*name) * 0x100000001b3;
+    }
+    return hash ? hash : 1;
+}
+
+static size_t
+su_history_file_size(uint64_t capacity) {
+    return sizeof(su_history_header_t) + capacity * sizeof(su_history_entry_t);
+}
+
+static bool
+su_history_map(su_history_t *history, size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, history->fd, 0);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    history->size = size;
+    history->header = p;
+    history->entries = (su_history_entry_t *)(history->header + 1);
+    return true;
+}
+
+/// Returns the slot of the test called `name` or the empty one it goes into.
+static su_history_entry_t *
+su_history_slot(su_history_t *history, uint64_t hash, const char *name) {
+    const uint64_t mask = history->header->capacity - 1;
+    for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+        su_history_entry_t *entry = &history->entries[i];
+        if (entry->hash == 0
+            || (entry->hash == hash
+                && strncmp(entry->name, name, sizeof(entry->name) - 1) == 0)) {
+            return entry;
+        }
+    }
+}
+
+/// Whether a used slot holds a name and its hash, anything else comes from a corrupt file.
+static bool
+su_history_entry_valid(const su_history_entry_t *entry) {
+    const size_t len = strnlen(entry->name, sizeof(entry->name));
+    if (!len || len == sizeof(entry->name)) {
+        return false;
+    }
+    // a name filling the buffer may be cut off, its hash is the one of the whole name
+    return len == sizeof(entry->name) - 1 || su_hash_name(entry->name) == entry->hash;
 }
 
 bool
-su_check_subproc_result(
-    const su_subproc_result_t *result,
-    su_subproc_predicate_t predicate,
-    const char *test_name,
-    int line
-) {
-    const bool status_matches = su_subproc_predicate_matches_status(predicate, result->status);
-    const bool output_matches
-        = !predicate.output || strcmp(predicate.output, result->standard_error) == 0;
-    if (status_matches && output_matches) {
+su_history_open(su_history_t *history, const char *path, size_t test_count) {
+    *history = (su_history_t){.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)};
+    if (history->fd == -1) {
+        perror(path);
         return false;
     }
-    printf("%s(%d): expected ", test_name, line);
-    if (!status_matches) {
-        if (predicate.any_abnormal) {
-            printf("abnormal exit, got %s\n", su_describe_status(result->status));
-        } else if (predicate.is_signal) {
-            printf(
-                "killed by signal %d, got %s\n",
-                predicate.code_or_signal,
-                su_describe_status(result->status)
-            );
+    // concurrent runs take turns
+    flock(history->fd, LOCK_EX);
+    struct stat st;
+    fstat(history->fd, &st);
+    su_history_entry_t *old = NULL;
+    uint64_t old_capacity = 0;
+    uint64_t count = 0;
+    if (st.st_size && (size_t)st.st_size >= sizeof(su_history_header_t)
+        && su_history_map(history, st.st_size)) {
+        const su_history_header_t *header = history->header;
+        const uint64_t capacity = header->capacity;
+        if (memcmp(header->magic, SU_HISTORY_MAGIC, sizeof(SU_HISTORY_MAGIC)) == 0
+            && capacity && !(capacity & (capacity - 1))
+            && (size_t)st.st_size == su_history_file_size(capacity)) {
+            uint64_t corrupt = 0;
+            for (uint64_t i = 0; i < capacity; ++i) {
+                if (history->entries[i].hash) {
+                    const bool valid = su_history_entry_valid(&history->entries[i]);
+                    count += valid;
+                    corrupt += !valid;
+                }
+            }
+            if (corrupt) {
+                fprintf(
+                    stderr, "%s: dropping %lu corrupt history entries\n", path,
+                    (unsigned long)corrupt
+                );
+            }
+            // keep the load factor at most 1/2
+            if (!corrupt && (count + test_count) * 2 <= capacity) {
+                history->header->count = count;
+                return true;
+            }
+            old = malloc(capacity * sizeof(*old));
+            memcpy(old, history->entries, capacity * sizeof(*old));
+            old_capacity = capacity;
         } else {
-            printf(
-                "exited with code %d, got %s\n",
-                predicate.code_or_signal,
-                su_describe_status(result->status)
-            );
+            fprintf(stderr, "%s: not a history file of this version, starting a new one\n", path);
+        }
+        munmap(history->header, history->size);
+    } else if (st.st_size) {
+        fprintf(stderr, "%s: truncated history file, starting a new one\n", path);
+    }
+    uint64_t capacity = 64;
+    while (capacity < (count + test_count) * 2) {
+        capacity *= 2;
+    }
+    const size_t size = su_history_file_size(capacity);
+    if (ftruncate(history->fd, 0) == -1 || ftruncate(history->fd, size) == -1
+        || !su_history_map(history, size)) {
+        perror(path);
+        free(old);
+        close(history->fd);
+        return false;
+    }
+    memcpy(history->header->magic, SU_HISTORY_MAGIC, sizeof(SU_HISTORY_MAGIC));
+    history->header->capacity = capacity;
+    history->header->count = count;
+    for (uint64_t i = 0; i < old_capacity; ++i) {
+        if (old[i].hash && su_history_entry_valid(&old[i])) {
+            *su_history_slot(history, old[i].hash, old[i].name) = old[i];
         }
-    } else {
-        printf("output \"%s\", got \"%s\"\n", predicate.output, result->standard_error);
     }
+    free(old);
     return true;
 }
+su_history_entry_t *
+su_history_lookup(su_history_t *history, const char *name, bool insert) {
+    const uint64_t hash = su_hash_name(name);
+    su_history_entry_t *entry = su_history_slot(history, hash, name);
+    if (entry->hash) {
+        return entry;
+    } else if (!insert || (history->header->count + 1) * 2 > history->header->capacity) {
+        return NULL;
+    }
+    entry->hash = hash;
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    ++history->header->count;
+    return entry;
+}
+void
+su_history_close(su_history_t *history) {
+    munmap(history->header, history->size);
+    close(history->fd);
+    *history = (su_history_t){.fd = -1};
+}
 
-// MARK: - Module
+// MARK: - Baselines
+
+// A baseline file has a line per benchmark, its `module.bench` name followed by its samples in
+// nanoseconds per iteration.  Lines starting with `#` are comments.
+
+static int
+su_compare_baselines(const void *a, const void *b) {
+    return strcmp(((const su_baseline_t *)a)->name, ((const su_baseline_t *)b)->name);
+}
 
+static su_baseline_t *
+su_baseline_find(su_baseline_t *baselines, size_t count, const char *name) {
+    const su_baseline_t key = {.name = (char *)name};
+    return count ? bsearch(&key, baselines, count, sizeof(key), su_compare_baselines) : NULL;
+}
+
+/// Reads the baselines of the state and attaches them to its benchmarks, a missing file has no
+/// baselines.
 static void
-su_print_results(su_count_t *counts, su_time_t runtime) {
-    const char *sep = "";
-    if (counts[SU_PASS]) {
-        printf("\x1b[32m%d passing\x1b[m", counts[SU_PASS]);
-        sep = " ";
+su_baseline_load(su_state_t *state, const char *path) {
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        if (errno != ENOENT) {
+            perror(path);
+        }
+        return;
     }
-    if (counts[SU_FAIL]) {
-        printf("%s\x1b[31m%d failing\x1b[m", sep, counts[SU_FAIL]);
-        sep = " ";
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, file) != -1) {
+        char *save;
+        const char *name = strtok_r(line, " \t\n", &save);
+        if (!name || *name == '#') {
+            continue;
+        }
+        su_baseline_t baseline = {.name = strdup(name)};
+        for (const char *field; (field = strtok_r(NULL, " \t\n", &save));) {
+            char *end;
+            const double sample = strtod(field, &end);
+            if (end != field && *end == '\0') {
+                arrput(baseline.samples, sample);
+            }
+        }
+        if (baseline.samples) {
+            qsort(baseline.samples, arrlen(baseline.samples), sizeof(double), su_compare_doubles);
+        }
+        arrput(state->baselines, baseline);
     }
-    if (counts[SU_SKIP]) {
-        printf("%s\x1b[33m%d skipped\x1b[m", sep, counts[SU_SKIP]);
+    free(line);
+    fclose(file);
+    const size_t count = arrlen(state->baselines);
+    if (count) {
+        qsort(state->baselines, count, sizeof(*state->baselines), su_compare_baselines);
     }
-    const double ms = su_time_ms(runtime);
-    if (ms >= 1000.0) {
-        printf(" \x1b[2m(%.2fs)\x1b[m\n", ms / 1000.0);
+    for (size_t i = 0; i < state->test_count; ++i) {
+        su_test_t *test = state->tests[i];
+        if (test->bench) {
+            test->bench->baseline = su_baseline_find(state->baselines, count, test->pretty_name);
+        }
+    }
+}
+
+/// Replaces the baselines of the benchmarks that passed and writes all baselines to `path`.
+static void
+su_baseline_save(su_state_t *state, const char *path) {
+    const size_t loaded = arrlen(state->baselines);
+    for (size_t i = 0; i < state->test_count; ++i) {
+        const su_test_t *test = state->tests[i];
+        if (!test->bench || test->status != SU_PASS) {
+            continue;
+        }
+        su_baseline_t *baseline = su_baseline_find(state->baselines, loaded, test->pretty_name);
+        if (!baseline) {
+            baseline = su_arrpush(state->baselines);
+            *baseline = (su_baseline_t){.name = strdup(test->pretty_name)};
+        }
+        if (baseline->samples) {
+            arrsetlen(baseline->samples, 0);
+        }
+        for (size_t j = 0; j < SU_BENCH_SAMPLES; ++j) {
+            arrput(baseline->samples, test->bench->stats.samples[j]);
+        }
+    }
+    const size_t count = arrlen(state->baselines);
+    if (count) {
+        qsort(state->baselines, count, sizeof(*state->baselines), su_compare_baselines);
+    }
+    // write a new file and rename it over the old one, so an interrupted update loses nothing
+    char *tmp;
+    if (asprintf(&tmp, "%s.tmp", path) == -1) {
+        return;
+    }
+    FILE *file = fopen(tmp, "we");
+    if (!file) {
+        perror(tmp);
+        free(tmp);
+        return;
+    }
+    fputs("# smallunit baseline: benchmark followed by its samples in ns per iteration\n", file);
+    for (size_t i = 0; i < count; ++i) {
+        fputs(state->baselines[i].name, file);
+        for (int j = 0; j < arrlen(state->baselines[i].samples); ++j) {
+            fprintf(file, " %.3f", state->baselines[i].samples[j]);
+        }
+        fputc('\n', file);
+    }
+    if (fclose(file) != 0 || rename(tmp, path) == -1) {
+        perror(path);
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+static void
+su_baseline_free(su_state_t *state) {
+    for (size_t i = 0; i < state->test_count; ++i) {
+        if (state->tests[i]->bench) {
+            state->tests[i]->bench->baseline = NULL;
+        }
+    }
+    for (int i = 0; i < arrlen(state->baselines); ++i) {
+        free(state->baselines[i].name);
+        arrfree(state->baselines[i].samples);
+    }
+    arrfree(state->baselines);
+}
+
+// MARK: - State
+
+static bool
+su_parse_unsigned(const char *value, unsigned *result) {
+    char *end;
+    const unsigned long n = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || n > UINT32_MAX) {
+        return false;
+    }
+    *result = (unsigned)n;
+    return true;
+}
+
+static bool
+su_parse_jobs(const char *value, unsigned *jobs) {
+    unsigned n;
+    if (!su_parse_unsigned(value, &n) || n > 4096) {
+        return false;
+    }
+    if (n == 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        *jobs = cpus > 0 ? (unsigned)cpus : 1;
     } else {
-        printf(" \x1b[2m(%lums)\x1b[m\n", (unsigned long)(ms + 0.5));
+        *jobs = (unsigned)n;
     }
+    return true;
 }
 
-void
-su_module_run_test(su_module_t *mod, su_test_t *test) {
-    struct timespec start, end;
-    test->status = SU_PASS;
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    mod->vtable->run(mod, test);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    test->runtime = su_time_sub(su_time_from(end), su_time_from(start));
+static bool
+su_env_flag(const char *name) {
+    const char *value = getenv(name);
+    return value && *value && !su_streq(value, "0");
 }
 
 void
-su_module_run(su_module_t *mod) {
-    printf("  %s\n", mod->name);
-    memset(mod->counts, 0, sizeof(mod->counts));
-    mod->runtime = (su_time_t){0};
-    mod->vtable->init(mod);
-    for (int i = 0; i < arrlen(mod->tests); ++i) {
-        su_test_t *test = &mod->tests[i];
-        su_module_run_test(mod, test);
-        ++mod->counts[test->status];
-        mod->runtime = su_time_add(mod->runtime, test->runtime);
-        printf("    %s \x1b[2m%s\x1b[m\n", SU_STATUS_LABELS[test->status], test->name);
+su_options_default(su_options_t *options) {
+    options->skip_death_tests = SU_RUNNING_ON_VALGRIND;
+    options->jobs = 1;
+    options->threads = 1;
+    options->bench_time_ms = 200;
+    const char *jobs = getenv("SU_JOBS");
+    if (jobs && *jobs && !su_parse_jobs(jobs, &options->jobs)) {
+        fprintf(stderr, "ignoring invalid SU_JOBS: %s\n", jobs);
+    }
+    const char *threads = getenv("SU_THREADS");
+    if (threads && *threads && !su_parse_jobs(threads, &options->threads)) {
+        fprintf(stderr, "ignoring invalid SU_THREADS: %s\n", threads);
+    }
+    options->timing = su_env_flag("SU_TIMING");
+    options->capture = su_env_flag("SU_CAPTURE");
+    options->counters = su_env_flag("SU_COUNTERS");
+    options->profile_dir = getenv("SU_PROFILE");
+    options->trace_path = getenv("SU_TRACE");
+    const char *filter = getenv("SU_FILTER");
+    if (filter && *filter) {
+        arrput(options->filters, filter);
+    }
+    const char *bench_time = getenv("SU_BENCH_TIME");
+    if (bench_time && *bench_time && !su_parse_unsigned(bench_time, &options->bench_time_ms)) {
+        fprintf(stderr, "ignoring invalid SU_BENCH_TIME: %s\n", bench_time);
+    }
+    options->history_path = getenv("SU_HISTORY");
+    options->reporter = getenv("SU_REPORTER");
+    if (options->reporter && !su_find_reporter(options->reporter)) {
+        fprintf(stderr, "ignoring invalid SU_REPORTER: %s\n", options->reporter);
+        options->reporter = NULL;
+    }
+    options->report_file = getenv("SU_REPORT_FILE");
+    const char *timeout = getenv("SU_TIMEOUT");
+    if (timeout && *timeout && !su_parse_unsigned(timeout, &options->timeout_ms)) {
+        fprintf(stderr, "ignoring invalid SU_TIMEOUT: %s\n", timeout);
+    }
+    options->baseline_path = getenv("SU_BASELINE");
+    options->update_baseline = su_env_flag("SU_UPDATE_BASELINE");
+    options->regression_threshold = 5;
+    const char *threshold = getenv("SU_REGRESSION_THRESHOLD");
+    if (threshold && *threshold && !su_parse_unsigned(threshold, &options->regression_threshold)) {
+        fprintf(stderr, "ignoring invalid SU_REGRESSION_THRESHOLD: %s\n", threshold);
     }
-    mod->vtable->clean(mod);
-    fputs("\n  ", stdout);
-    su_print_results(mod->counts, mod->runtime);
-    fputc('\n', stdout);
 }
 
-static void
-su_noop(void *_) {
-    (void)_;
+/// Matches `-s VALUE`, `-sVALUE`, `--long VALUE`, and `--long=VALUE`, advancing `*i` past the
+/// value.
+/// `*value` is set to `NULL` if the option matches but has no value.
+static bool
+su_option_value(
+    int argc, char **argv, int *i, const char *short_name, const char *long_name, const char **value
+) {
+    const char *arg = argv[*i];
+    const size_t long_len = strlen(long_name);
+    if (strncmp(arg, long_name, long_len) == 0 && arg[long_len] == '=') {
+        *value = arg + long_len + 1;
+        return true;
+    }
+    if (short_name && strncmp(arg, short_name, 2) == 0 && arg[2] != '\0') {
+        *value = arg + 2;
+        return true;
+    }
+    if (!su_streq(arg, long_name) && !(short_name && su_streq(arg, short_name))) {
+        return false;
+    }
+    *value = *i + 1 < argc ? argv[++*i] : NULL;
+    return true;
+}
+
+bool
+su_options_parse(su_options_t *options, int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *value;
+        if (su_option_value(argc, argv, &i, "-j", "--jobs", &value)) {
+            if (!value || !su_parse_jobs(value, &options->jobs)) {
+                fprintf(stderr, "invalid job count: %s\n", value ? value : "(none)");
+                return false;
+            }
+        } else if (su_option_value(argc, argv, &i, "-t", "--threads", &value)) {
+            if (!value || !su_parse_jobs(value, &options->threads)) {
+                fprintf(stderr, "invalid thread count: %s\n", value ? value : "(none)");
+                return false;
+            }
+        } else if (su_streq(argv[i], "--timing")) {
+            options->timing = true;
+        } else if (su_streq(argv[i], "--counters")) {
+            options->counters = true;
+        } else if (su_option_value(argc, argv, &i, NULL, "--profile", &value)) {
+            if (!value) {
+                fputs("missing profile directory\n", stderr);
+                return false;
+            }
+            options->profile_dir = value;
+        } else if (su_option_value(argc, argv, &i, NULL, "--trace", &value)) {
+            if (!value) {
+                fputs("missing trace file\n", stderr);
+                return false;
+            }
+            options->trace_path = value;
+        } else if (su_streq(argv[i], "--capture")) {
+            options->capture = true;
+        } else if (su_streq(argv[i], "--list")) {
+            options->list = true;
+        } else if (su_option_value(argc, argv, &i, NULL, "--filter", &value)) {
+            if (!value) {
+                fputs("missing filter pattern\n", stderr);
+                return false;
+            }
+            arrput(options->filters, value);
+        } else if (su_option_value(argc, argv, &i, NULL, "--tag", &value)) {
+            if (!value) {
+                fputs("missing tag\n", stderr);
+                return false;
+            }
+            arrput(options->tags, value);
+        } else if (su_option_value(argc, argv, &i, NULL, "--bench-time", &value)) {
+            if (!value || !su_parse_unsigned(value, &options->bench_time_ms)) {
+                fprintf(stderr, "invalid benchmark time: %s\n", value ? value : "(none)");
+                return false;
+            }
+        } else if (su_option_value(argc, argv, &i, NULL, "--history", &value)) {
+            if (!value) {
+                fputs("missing history file\n", stderr);
+                return false;
+            }
+            options->history_path = value;
+        } else if (su_option_value(argc, argv, &i, NULL, "--reporter", &value)) {
+            if (!value || !su_find_reporter(value)) {
+                fprintf(stderr, "invalid reporter: %s\n", value ? value : "(none)");
+                return false;
+            }
+            options->reporter = value;
+        } else if (su_option_value(argc, argv, &i, NULL, "--report-file", &value)) {
+            if (!value) {
+                fputs("missing report file\n", stderr);
+                return false;
+            }
+            options->report_file = value;
+        } else if (su_option_value(argc, argv, &i, NULL, "--timeout", &value)) {
+            if (!value || !su_parse_unsigned(value, &options->timeout_ms)) {
+                fprintf(stderr, "invalid timeout: %s\n", value ? value : "(none)");
+                return false;
+            }
+        } else if (su_option_value(argc, argv, &i, NULL, "--baseline", &value)) {
+            if (!value) {
+                fputs("missing baseline file\n", stderr);
+                return false;
+            }
+            options->baseline_path = value;
+        } else if (su_streq(argv[i], "--update-baseline")) {
+            options->update_baseline = true;
+        } else if (su_option_value(argc, argv, &i, NULL, "--regression-threshold", &value)) {
+            if (!value || !su_parse_unsigned(value, &options->regression_threshold)) {
+                fprintf(stderr, "invalid regression threshold: %s\n", value ? value : "(none)");
+                return false;
+            }
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+extern su_test_t *__start_su_tests[] __attribute__((weak));
+extern su_test_t *__stop_su_tests[] __attribute__((weak));
+extern const su_fixture_mode_def_t *__start_su_fixture_modes[] __attribute__((weak));
+extern const su_fixture_mode_def_t *__stop_su_fixture_modes[] __attribute__((weak));
+extern const su_timeout_def_t *__start_su_timeouts[] __attribute__((weak));
+extern const su_timeout_def_t *__stop_su_timeouts[] __attribute__((weak));
+extern const su_bench_options_def_t *__start_su_bench_options[] __attribute__((weak));
+extern const su_bench_options_def_t *__stop_su_bench_options[] __attribute__((weak));
+
+void
+su_options_drop(su_options_t *options) {
+    arrfree(options->filters);
+    arrfree(options->tags);
 }
 
+/// Matches `name` against a `:` separated list of patterns, `*positive` is set if any of them is
+/// an including one.
 static void
-su_run_stateless_test(void *_, su_test_t *test) {
-    (void)_;
-    ((su_stateless_test_fn_t)test->fn)(test);
+su_match_filter(
+    const char *filter, const char *name, bool *positive, bool *included, bool *excluded
+) {
+    char buf[256];
+    while (*filter) {
+        const size_t len = strcspn(filter, ":");
+        if (len) {
+            // patterns are copied to terminate them, only long ones need the heap
+            char *pattern = len < sizeof(buf) ? buf : malloc(len + 1);
+            const bool negative = filter[0] == '-';
+            memcpy(pattern, filter + negative, len - negative);
+            pattern[len - negative] = '\0';
+            const bool matches = fnmatch(pattern, name, 0) == 0;
+            if (negative) {
+                *excluded = *excluded || matches;
+            } else {
+                *positive = true;
+                *included = *included || matches;
+            }
+            if (pattern != buf) {
+                free(pattern);
+            }
+        }
+        filter += len + (filter[len] == ':');
+    }
 }
 
-static const su_module_vtable_t SU_MODULE_VTABLE = {
-    .init = su_noop,
-    .clean = su_noop,
-    .run = su_run_stateless_test,
-};
+static bool
+su_has_tag(const char *tags, const char *tag) {
+    const size_t tag_len = strlen(tag);
+    while (tags && *tags) {
+        tags += strspn(tags, ", ");
+        const size_t len = strcspn(tags, ", ");
+        if (len == tag_len && strncmp(tags, tag, len) == 0) {
+            return true;
+        }
+        tags += len;
+    }
+    return false;
+}
+
+bool
+su_options_select(const su_options_t *options, const su_test_t *test) {
+    bool positive = false;
+    bool included = false;
+    bool excluded = false;
+    for (int i = 0; i < arrlen(options->filters); ++i) {
+        su_match_filter(options->filters[i], test->pretty_name, &positive, &included, &excluded);
+    }
+    if (excluded || (positive && !included)) {
+        return false;
+    }
+    positive = false;
+    included = false;
+    for (int i = 0; i < arrlen(options->tags); ++i) {
+        const char *tag = options->tags[i];
+        if (tag[0] == '-') {
+            if (su_has_tag(test->tags, tag + 1)) {
+                return false;
+            }
+        } else {
+            positive = true;
+            included = included || su_has_tag(test->tags, tag);
+        }
+    }
+    return !positive || included;
+}
+
+// `su_state_init` stores the sort key in `order`, the major key in the upper bits
+#define SU_ORDER_SHIFT 40
+
+static bool
+su_test_less(const su_test_t *a, const su_test_t *b) {
+    return a->order < b->order;
+}
 
 static void
-su_fixture_owner_init(void *p_self) {
-    su_fixture_owner_t *self = p_self;
-    self->fixture = calloc(1, self->object_size);
-    self->setup(self->fixture);
+su_sift_down(su_test_t **tests, size_t root, size_t count) {
+    for (size_t child; (child = 2 * root + 1) < count; root = child) {
+        if (child + 1 < count && su_test_less(tests[child], tests[child + 1])) {
+            ++child;
+        }
+        if (!su_test_less(tests[root], tests[child])) {
+            return;
+        }
+        su_test_t *const tmp = tests[root];
+        tests[root] = tests[child];
+        tests[child] = tmp;
+    }
 }
 
+/// Sorts in place, `qsort` may allocate.  The section is usually already sorted or reversed
+/// (depending on how the compiler emits the variables) so check for those first.
 static void
-su_fixture_owner_clean(void *p_self) {
-    su_fixture_owner_t *self = p_self;
-    self->tear_down(self->fixture);
-    free(self->fixture);
+su_sort_tests(su_test_t **tests, size_t count) {
+    bool sorted = true;
+    bool reversed = true;
+    for (size_t i = 1; i < count && (sorted || reversed); ++i) {
+        sorted = sorted && !su_test_less(tests[i], tests[i - 1]);
+        reversed = reversed && su_test_less(tests[i], tests[i - 1]);
+    }
+    if (sorted) {
+        return;
+    }
+    if (reversed) {
+        for (size_t i = 0; i < count / 2; ++i) {
+            su_test_t *const tmp = tests[i];
+            tests[i] = tests[count - 1 - i];
+            tests[count - 1 - i] = tmp;
+        }
+        return;
+    }
+    for (size_t i = count / 2; i-- > 0;) {
+        su_sift_down(tests, i, count);
+    }
+    for (size_t i = count; i-- > 1;) {
+        su_test_t *const tmp = tests[0];
+        tests[0] = tests[i];
+        tests[i] = tmp;
+        su_sift_down(tests, 0, i);
+    }
 }
 
 static void
-su_run_fixture_test(void *p_self, su_test_t *test) {
-    su_fixture_owner_t *self = p_self;
-    ((su_fixture_test_fn_t)test->fn)(test, self->fixture);
+su_register_module(su_state_t *state, su_module_t **tail, su_test_t *test) {
+    su_module_t *mod = test->module;
+    mod->name = test->module_name;
+    if (test->fixture) {
+        su_fixture_owner_t *owner = (su_fixture_owner_t *)mod;
+        owner->object_size = test->fixture->object_size;
+        owner->setup = test->fixture->setup;
+        owner->tear_down = test->fixture->tear_down;
+        mod->vtable = SU_FIXTURE_VTABLES[owner->mode];
+    } else {
+        mod->vtable = &SU_MODULE_VTABLE;
+    }
+    mod->index = state->module_count++;
+    mod->registered = true;
+    if (*tail) {
+        (*tail)->next = mod;
+    } else {
+        state->modules = mod;
+    }
+    *tail = mod;
 }
 
-static const su_module_vtable_t SU_FIXTURE_OWNER_VTABLE = {
-    .init = su_fixture_owner_init,
-    .clean = su_fixture_owner_clean,
-    .run = su_run_fixture_test,
-};
+static void
+su_apply_timeout(su_state_t *state, const su_timeout_def_t *def) {
+    for (su_module_t *mod = state->modules; mod; mod = mod->next) {
+        if (strcmp(mod->name, def->module_name) != 0) {
+            continue;
+        }
+        for (size_t i = 0; i < mod->test_count; ++i) {
+            if (!def->test_name || strcmp(mod->tests[i]->name, def->test_name) == 0) {
+                mod->tests[i]->timeout_ms = def->ms;
+            }
+        }
+    }
+}
 
-// MARK: - State
+void
+su_state_init(su_state_t *state) {
+    if (state->initialized) {
+        return;
+    }
+    state->initialized = true;
+    for (const su_fixture_mode_def_t **def = __start_su_fixture_modes;
+         def != __stop_su_fixture_modes;
+         ++def) {
+        (*def)->owner->mode = (*def)->mode;
+        (*def)->owner->clone = (*def)->clone;
+    }
+    for (const su_bench_options_def_t **def = __start_su_bench_options;
+         def != __stop_su_bench_options;
+         ++def) {
+        (*def)->bench->options = (*def)->options;
+    }
+    state->tests = __start_su_tests;
+    state->test_count = __stop_su_tests - __start_su_tests;
+    // sections of different translation units are concatenated in link order
+    size_t rank = 0;
+    for (size_t i = 0; i < state->test_count; ++i) {
+        su_test_t *test = state->tests[i];
+        if (!test->translation_unit->rank) {
+            test->translation_unit->rank = ++rank;
+        }
+        test->order = (uint64_t)test->translation_unit->rank << SU_ORDER_SHIFT | test->counter;
+    }
+    su_sort_tests(state->tests, state->test_count);
+    su_module_t *tail = NULL;
+    for (size_t i = 0; i < state->test_count; ++i) {
+        su_test_t *test = state->tests[i];
+        if (!test->module->registered) {
+            su_register_module(state, &tail, test);
+        }
+        test->order = (uint64_t)test->module->index << SU_ORDER_SHIFT | i;
+    }
+    su_sort_tests(state->tests, state->test_count);
+    for (size_t i = 0; i < state->test_count;) {
+        su_module_t *mod = state->tests[i]->module;
+        mod->tests = &state->tests[i];
+        for (mod->test_count = 0; i < state->test_count && state->tests[i]->module == mod; ++i) {
+            state->tests[i]->order = i;
+            ++mod->test_count;
+        }
+    }
+    // test timeouts override module timeouts
+    for (const su_timeout_def_t **def = __start_su_timeouts; def != __stop_su_timeouts; ++def) {
+        if (!(*def)->test_name) {
+            su_apply_timeout(state, *def);
+        }
+    }
+    for (const su_timeout_def_t **def = __start_su_timeouts; def != __stop_su_timeouts; ++def) {
+        if ((*def)->test_name) {
+            su_apply_timeout(state, *def);
+        }
+    }
+}
 
 void
-su_options_default(su_options_t *options) {
-    options->skip_death_tests = SU_RUNNING_ON_VALGRIND;
+su_state_select(su_state_t *state) {
+    if (!arrlen(state->options.filters) && !arrlen(state->options.tags)) {
+        return;
+    }
+    // move the selected tests to the front, keeping their order
+    size_t selected = 0;
+    for (size_t i = 0; i < state->test_count; ++i) {
+        if (su_options_select(&state->options, state->tests[i])) {
+            su_test_t *const tmp = state->tests[selected];
+            state->tests[selected++] = state->tests[i];
+            state->tests[i] = tmp;
+        }
+    }
+    state->test_count = selected;
+    state->modules = NULL;
+    state->module_count = 0;
+    su_module_t *tail = NULL;
+    for (size_t i = 0; i < state->test_count;) {
+        su_module_t *mod = state->tests[i]->module;
+        mod->tests = &state->tests[i];
+        mod->index = state->module_count++;
+        mod->next = NULL;
+        for (mod->test_count = 0; i < state->test_count && state->tests[i]->module == mod; ++i) {
+            state->tests[i]->order = i;
+            ++mod->test_count;
+        }
+        if (tail) {
+            tail->next = mod;
+        } else {
+            state->modules = mod;
+        }
+        tail = mod;
+    }
 }
 
-su_module_t *
-su_state_get_module(su_state_t *state, const char *name) {
-    const ptrdiff_t index = shgeti(state->modules_by_name, name);
-    if (index < 0) {
-        su_module_t *mod = calloc(1, sizeof(*mod));
-        mod->name = name;
-        mod->vtable = &SU_MODULE_VTABLE;
-        // NOLINTNEXTLINE
-        arrput(state->modules, mod);
-        shput(state->modules_by_name, name, mod);
-        return mod;
-    } else {
-        return state->modules_by_name[index].value;
+typedef struct {
+    su_module_t *mod;
+    bool failed;
+    uint64_t runtime;
+} su_schedule_t;
+
+typedef struct {
+    uint32_t index;
+    bool failed;
+    uint64_t runtime;
+} su_test_schedule_t;
+
+static int
+su_compare_test_schedule(const void *a_, const void *b_) {
+    const su_test_schedule_t *a = a_;
+    const su_test_schedule_t *b = b_;
+    if (a->failed != b->failed) {
+        return a->failed ? -1 : 1;
+    } else if (a->runtime != b->runtime) {
+        return a->runtime > b->runtime ? -1 : 1;
     }
+    return a->index < b->index ? -1 : a->index > b->index;
 }
 
-su_fixture_owner_t *
-su_state_get_fixture(su_state_t *state, const char *name) {
-    const ptrdiff_t index = shgeti(state->fixtures_by_name, name);
-    if (index < 0) {
-        su_fixture_owner_t *fixture = calloc(1, sizeof(*fixture));
-        fixture->mod.name = name;
-        fixture->mod.vtable = &SU_FIXTURE_OWNER_VTABLE;
-        // NOLINTNEXTLINE
-        arrput(state->modules, (su_module_t *)fixture);
-        shput(state->fixtures_by_name, name, fixture);
-        return fixture;
-    } else {
-        return state->fixtures_by_name[index].value;
+static int
+su_compare_schedule(const void *a_, const void *b_) {
+    const su_schedule_t *a = a_;
+    const su_schedule_t *b = b_;
+    if (a->failed != b->failed) {
+        return a->failed ? -1 : 1;
+    } else if (a->runtime != b->runtime) {
+        return a->runtime > b->runtime ? -1 : 1;
+    }
+    return a->mod->index < b->mod->index ? -1 : a->mod->index > b->mod->index;
+}
+
+void
+su_state_schedule(su_state_t *state, su_history_t *history) {
+    const bool parallel = state->options.jobs > 1 && state->module_count > 1;
+    const bool threaded = !parallel && state->options.threads > 1;
+    su_schedule_t *schedule = calloc(state->module_count, sizeof(*schedule));
+    su_test_schedule_t *tests = threaded ? calloc(state->test_count, sizeof(*tests)) : NULL;
+    size_t count = 0;
+    for (su_module_t *mod = state->modules; mod; mod = mod->next) {
+        su_schedule_t *s = &schedule[count++];
+        s->mod = mod;
+        for (size_t i = 0; i < mod->test_count; ++i) {
+            const su_history_entry_t *entry
+                = su_history_lookup(history, mod->tests[i]->pretty_name, false);
+            const bool failed
+                = entry && (entry->status == SU_FAIL || entry->status == SU_TIMEOUT);
+            if (entry) {
+                s->failed |= failed;
+                // the order of a single process does not change the total time
+                s->runtime += parallel ? entry->runtime : 0;
+            }
+            if (tests) {
+                const uint32_t index = mod->tests + i - state->tests;
+                tests[index] = (su_test_schedule_t){
+                    .index = index,
+                    .failed = failed,
+                    .runtime = entry ? entry->runtime : 0,
+                };
+            }
+        }
+    }
+    qsort(schedule, count, sizeof(*schedule), su_compare_schedule);
+    if (tests) {
+        qsort(tests, state->test_count, sizeof(*tests), su_compare_test_schedule);
+        state->thread_order = malloc((state->test_count + 1) * sizeof(*state->thread_order));
+        for (size_t i = 0; i < state->test_count; ++i) {
+            state->thread_order[i] = tests[i].index;
+        }
+        free(tests);
+    }
+    su_module_t **tail = &state->modules;
+    for (size_t i = 0; i < count; ++i) {
+        *tail = schedule[i].mod;
+        tail = &schedule[i].mod->next;
     }
+    *tail = NULL;
+    free(schedule);
 }
 
 void
-su_state_set_test_name(su_state_t *state, const char *function_name, const char *pretty_name) {
-    shput(state->test_names, function_name, pretty_name);
+su_state_record(const su_state_t *state, su_history_t *history) {
+    for (size_t i = 0; i < state->test_count; ++i) {
+        const su_test_t *test = state->tests[i];
+        su_history_entry_t *entry = su_history_lookup(history, test->pretty_name, true);
+        if (!entry) {
+            continue;
+        }
+        const uint64_t runtime = test->runtime.value;
+        entry->runtime = entry->runs ? (entry->runtime * 3 + runtime) / 4 : runtime;
+        entry->status = test->status;
+        ++entry->runs;
+    }
 }
 
-const char *
-su_state_test_name(su_state_t *state, const char *function_name, const char *pretty_name) {
-    const ptrdiff_t index = shgeti(state->test_names, function_name);
-    if (index < 0) {
-        return pretty_name;
-    } else {
-        return state->test_names[index].value;
+/// Whether any of the selected tests has a timeout.
+static bool
+su_state_has_timeouts(const su_state_t *state) {
+    for (size_t i = 0; i < state->test_count; ++i) {
+        if (state->tests[i]->timeout_ms || state->options.timeout_ms) {
+            return true;
+        }
     }
+    return false;
 }
 
 su_result_t su_state_run(su_state_t *state) {
@@ -676,29 +6205,89 @@ su_result_t su_state_run(su_state_t *state) {
         su_options_default(&state->options);
         state->options_initialized = true;
     }
-    for (int i = 0; i < arrlen(state->modules); ++i) {
-        su_module_t *mod = state->modules[i];
-        su_module_run(mod);
+    su_state_init(state);
+    su_state_select(state);
+    if (state->options.list) {
+        for (size_t i = 0; i < state->test_count; ++i) {
+            puts(state->tests[i]->pretty_name);
+        }
+        return result;
+    }
+    // a timeout poisons the process running the test, which must not be the one reporting
+    const bool parallel = (state->options.jobs > 1 && state->module_count > 1)
+                       || (state->options.threads <= 1 && su_state_has_timeouts(state));
+    // failures in a junit report carry the output of their test
+    if (state->options.reporter && su_streq(state->options.reporter, "junit")
+        && (parallel || state->options.threads <= 1)) {
+        state->options.capture = true;
+    }
+    su_reporter_t *reporter = &state->reporter;
+    su_reporter_open(reporter, &state->options);
+    reporter->vtable->begin(reporter, state->test_count);
+    su_history_t history = {.fd = -1};
+    if (state->options.history_path
+        && su_history_open(&history, state->options.history_path, state->test_count)) {
+        su_state_schedule(state, &history);
+    }
+    if (state->options.baseline_path) {
+        su_baseline_load(state, state->options.baseline_path);
+    }
+    if (state->options.trace_path) {
+        su_trace_open(state->options.trace_path);
+    }
+    const char *profile_dir = state->options.profile_dir;
+    if (profile_dir && mkdir(profile_dir, 0777) == -1 && errno != EEXIST) {
+        perror(profile_dir);
+    }
+    if (parallel) {
+        su_state_run_parallel(state);
+    } else if (state->options.threads > 1) {
+        su_state_run_threaded(state);
+    } else {
+        for (su_module_t *mod = state->modules; mod; mod = mod->next) {
+            su_module_run(mod, reporter);
+        }
+        su_timeout_release();
+        su_regex_release();
+        su_counters_close();
+        su_profile_release();
+    }
+    su_trace_close();
+    su_profile_free_symbols();
+    for (const su_module_t *mod = state->modules; mod; mod = mod->next) {
         result.counts[SU_PASS] += mod->counts[SU_PASS];
         result.counts[SU_FAIL] += mod->counts[SU_FAIL];
         result.counts[SU_SKIP] += mod->counts[SU_SKIP];
+        result.counts[SU_TIMEOUT] += mod->counts[SU_TIMEOUT];
         result.runtime = su_time_add(result.runtime, mod->runtime);
     }
-    fputs("Total:\n  ", stdout);
-    su_print_results(result.counts, result.runtime);
+    reporter->vtable->end(reporter, &result);
+    su_reporter_close(reporter);
+    if (history.fd != -1) {
+        su_state_record(state, &history);
+        su_history_close(&history);
+    }
+    if (state->options.baseline_path && state->options.update_baseline) {
+        su_baseline_save(state, state->options.baseline_path);
+    }
+    su_baseline_free(state);
     return result;
 }
 
 void
 su_state_drop(su_state_t *state) {
-    for (int i = 0; i < arrlen(state->modules); ++i) {
-        arrfree(state->modules[i]->tests);
-        free(state->modules[i]);
+    // everything is statically allocated, just forget the registration (of all tests, not only
+    // the selected ones)
+    for (su_test_t **test = __start_su_tests; test != __stop_su_tests; ++test) {
+        (*test)->translation_unit->rank = 0;
+        (*test)->module->registered = false;
+        (*test)->module->next = NULL;
     }
-    arrfree(state->modules);
-    shfree(state->modules_by_name);
-    shfree(state->fixtures_by_name);
-    shfree(state->test_names);
+    state->modules = NULL;
+    state->module_count = 0;
+    state->tests = NULL;
+    state->test_count = 0;
+    state->initialized = false;
 }
 
 // MARK: - Float
@@ -740,18 +6329,795 @@ su_float_sign_magnitude_to_biased(su_float_t f) {
 }
 
 // https://gist.github.com/2b-t/02daa85ea5d83fc2cb96bfcf0570ab71
-bool
-su_float_eq(su_float_t a, su_float_t b) {
+uint64_t
+su_float_distance(su_float_t a, su_float_t b) {
     if (a.is_nan || b.is_nan) {
-        return false;
+        return UINT64_MAX;
     }
     if (a.is_inf != b.is_inf || a.sign != b.sign) {
-        return false;
+        return UINT64_MAX;
     }
     const uint64_t a_biased = su_float_sign_magnitude_to_biased(a);
     const uint64_t b_biased = su_float_sign_magnitude_to_biased(b);
-    const uint64_t distance = a_biased > b_biased ? a_biased - b_biased : b_biased - a_biased;
-    return distance <= 4;
+    return a_biased > b_biased ? a_biased - b_biased : b_biased - a_biased;
+}
+
+bool
+su_float_eq(su_float_t a, su_float_t b) {
+    return su_float_distance(a, b) <= 4;
+}
+
+// The array comparisons first find the largest error with the kernels below, which is all a
+// passing comparison needs.  With equal signs the biased distance is the difference of the
+// magnitudes, so the kernels work on the bits directly.  A failing comparison is looked at
+// again element by element to report it.
+
+static uint64_t
+su_float_bits_distance(uint32_t a, uint32_t b) {
+    const uint32_t abs_a = a & 0x7fffffff;
+    const uint32_t abs_b = b & 0x7fffffff;
+    if (abs_a > 0x7f800000 || abs_b > 0x7f800000 || (abs_a == 0x7f800000) != (abs_b == 0x7f800000)
+        || (a ^ b) >> 31) {
+        return UINT64_MAX;
+    }
+    return abs_a > abs_b ? abs_a - abs_b : abs_b - abs_a;
+}
+
+static uint64_t
+su_double_bits_distance(uint64_t a, uint64_t b) {
+    const uint64_t inf = 0x7ff0000000000000;
+    const uint64_t abs_a = a & 0x7fffffffffffffff;
+    const uint64_t abs_b = b & 0x7fffffffffffffff;
+    if (abs_a > inf || abs_b > inf || (abs_a == inf) != (abs_b == inf) || (a ^ b) >> 63) {
+        return UINT64_MAX;
+    }
+    return abs_a > abs_b ? abs_a - abs_b : abs_b - abs_a;
+}
+
+static uint64_t
+su_float_max_ulps_scalar(const float *a, const float *b, size_t n) {
+    uint64_t max = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t x, y;
+        memcpy(&x, &a[i], sizeof(x));
+        memcpy(&y, &b[i], sizeof(y));
+        const uint64_t distance = su_float_bits_distance(x, y);
+        max = distance > max ? distance : max;
+    }
+    return max;
+}
+
+static uint64_t
+su_double_max_ulps_scalar(const double *a, const double *b, size_t n) {
+    uint64_t max = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t x, y;
+        memcpy(&x, &a[i], sizeof(x));
+        memcpy(&y, &b[i], sizeof(y));
+        const uint64_t distance = su_double_bits_distance(x, y);
+        max = distance > max ? distance : max;
+    }
+    return max;
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2"))) static uint64_t
+su_float_max_ulps_avx2(const float *a, const float *b, size_t n) {
+    const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i inf = _mm256_set1_epi32(0x7f800000);
+    __m256i max = _mm256_setzero_si256();
+    __m256i never_equal = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        const __m256i abs_x = _mm256_and_si256(x, abs_mask);
+        const __m256i abs_y = _mm256_and_si256(y, abs_mask);
+        const __m256i nan =
+            _mm256_or_si256(_mm256_cmpgt_epi32(abs_x, inf), _mm256_cmpgt_epi32(abs_y, inf));
+        const __m256i one_inf =
+            _mm256_xor_si256(_mm256_cmpeq_epi32(abs_x, inf), _mm256_cmpeq_epi32(abs_y, inf));
+        // the sign bit of the xor is set if the signs differ
+        never_equal = _mm256_or_si256(
+            never_equal, _mm256_or_si256(_mm256_or_si256(nan, one_inf), _mm256_xor_si256(x, y))
+        );
+        max = _mm256_max_epu32(max, _mm256_abs_epi32(_mm256_sub_epi32(abs_x, abs_y)));
+    }
+    // only the sign bits of `never_equal` mean anything
+    if (_mm256_movemask_ps(_mm256_castsi256_ps(never_equal))) {
+        return UINT64_MAX;
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, max);
+    uint64_t result = su_float_max_ulps_scalar(a + i, b + i, n - i);
+    for (int j = 0; j < 8; ++j) {
+        result = lanes[j] > result ? lanes[j] : result;
+    }
+    return result;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+su_double_max_ulps_avx2(const double *a, const double *b, size_t n) {
+    const __m256i abs_mask = _mm256_set1_epi64x(0x7fffffffffffffff);
+    const __m256i inf = _mm256_set1_epi64x(0x7ff0000000000000);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i max = zero;
+    __m256i never_equal = zero;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        const __m256i abs_x = _mm256_and_si256(x, abs_mask);
+        const __m256i abs_y = _mm256_and_si256(y, abs_mask);
+        const __m256i nan =
+            _mm256_or_si256(_mm256_cmpgt_epi64(abs_x, inf), _mm256_cmpgt_epi64(abs_y, inf));
+        const __m256i one_inf =
+            _mm256_xor_si256(_mm256_cmpeq_epi64(abs_x, inf), _mm256_cmpeq_epi64(abs_y, inf));
+        never_equal = _mm256_or_si256(
+            never_equal, _mm256_or_si256(_mm256_or_si256(nan, one_inf), _mm256_xor_si256(x, y))
+        );
+        // there is no 64 bit abs or unsigned max, but magnitudes fit into 63 bits
+        const __m256i diff = _mm256_sub_epi64(abs_x, abs_y);
+        const __m256i negative = _mm256_cmpgt_epi64(zero, diff);
+        const __m256i distance = _mm256_sub_epi64(_mm256_xor_si256(diff, negative), negative);
+        max = _mm256_blendv_epi8(max, distance, _mm256_cmpgt_epi64(distance, max));
+    }
+    if (_mm256_movemask_pd(_mm256_castsi256_pd(never_equal))) {
+        return UINT64_MAX;
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, max);
+    uint64_t result = su_double_max_ulps_scalar(a + i, b + i, n - i);
+    for (int j = 0; j < 4; ++j) {
+        result = lanes[j] > result ? lanes[j] : result;
+    }
+    return result;
+}
+
+/// Returns whether any element differs by more than `abs_err` (or is NaN).
+__attribute__((target("avx2"))) static bool
+su_float_any_far_avx2(const float *a, const float *b, size_t n, double abs_err) {
+    const __m256d limit = _mm256_set1_pd(abs_err);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256d far = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 diff =
+            _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)), abs_mask);
+        // compared in double like `su_expect_near`
+        far = _mm256_or_pd(
+            far, _mm256_cmp_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(diff)), limit, _CMP_NLE_UQ)
+        );
+        far = _mm256_or_pd(
+            far, _mm256_cmp_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(diff, 1)), limit, _CMP_NLE_UQ)
+        );
+    }
+    for (; i < n; ++i) {
+        if (!(fabs(a[i] - b[i]) <= abs_err)) {
+            return true;
+        }
+    }
+    return _mm256_movemask_pd(far) != 0;
+}
+
+__attribute__((target("avx2"))) static bool
+su_double_any_far_avx2(const double *a, const double *b, size_t n, double abs_err) {
+    const __m256d limit = _mm256_set1_pd(abs_err);
+    const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffff));
+    __m256d far = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256d diff =
+            _mm256_and_pd(_mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)), abs_mask);
+        far = _mm256_or_pd(far, _mm256_cmp_pd(diff, limit, _CMP_NLE_UQ));
+    }
+    for (; i < n; ++i) {
+        if (!(fabs(a[i] - b[i]) <= abs_err)) {
+            return true;
+        }
+    }
+    return _mm256_movemask_pd(far) != 0;
+}
+#endif
+
+static uint64_t
+su_float_max_ulps(const float *a, const float *b, size_t n) {
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        return su_float_max_ulps_avx2(a, b, n);
+    }
+#endif
+    return su_float_max_ulps_scalar(a, b, n);
+}
+
+static uint64_t
+su_double_max_ulps(const double *a, const double *b, size_t n) {
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        return su_double_max_ulps_avx2(a, b, n);
+    }
+#endif
+    return su_double_max_ulps_scalar(a, b, n);
+}
+
+static bool
+su_float_any_far(const float *a, const float *b, size_t n, double abs_err) {
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        return su_float_any_far_avx2(a, b, n, abs_err);
+    }
+#endif
+    for (size_t i = 0; i < n; ++i) {
+        if (!(fabs(a[i] - b[i]) <= abs_err)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+su_double_any_far(const double *a, const double *b, size_t n, double abs_err) {
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        return su_double_any_far_avx2(a, b, n, abs_err);
+    }
+#endif
+    for (size_t i = 0; i < n; ++i) {
+        if (!(fabs(a[i] - b[i]) <= abs_err)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Reads element `i` of a float or double array.
+static double
+su_float_array_get(const void *p, bool is_double, size_t i) {
+    return is_double ? ((const double *)p)[i] : ((const float *)p)[i];
+}
+
+/// Absolute error of element `i`, computed in the precision of the arrays like `su_expect_near`.
+static double
+su_float_array_error(const void *a, const void *b, bool is_double, size_t i) {
+    if (is_double) {
+        return fabs(((const double *)a)[i] - ((const double *)b)[i]);
+    }
+    return fabs(((const float *)a)[i] - ((const float *)b)[i]);
+}
+
+static void
+su_report_ulps(
+    const void *a,
+    const void *b,
+    bool is_double,
+    size_t n,
+    uint64_t max_ulps,
+    const char *expr,
+    const char *test_name,
+    int line
+) {
+    // error magnitudes, the last bucket holds values that are never almost equal
+    static const uint64_t BUCKETS[] = {0, 1, 2, 4, 16, 256, 65536, UINT64_MAX};
+    enum { BUCKET_COUNT = sizeof(BUCKETS) / sizeof(BUCKETS[0]) };
+    size_t histogram[BUCKET_COUNT] = {0};
+    size_t failed = 0;
+    size_t worst = 0;
+    uint64_t worst_distance = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const double x = su_float_array_get(a, is_double, i);
+        const double y = su_float_array_get(b, is_double, i);
+        const uint64_t distance = is_double
+                                    ? su_float_distance(su_float_double(x), su_float_double(y))
+                                    : su_float_distance(su_float_float(x), su_float_float(y));
+        size_t bucket = 0;
+        while (bucket + 1 < BUCKET_COUNT && distance >= BUCKETS[bucket + 1]) {
+            ++bucket;
+        }
+        ++histogram[bucket];
+        failed += distance > max_ulps;
+        if (distance > worst_distance) {
+            worst_distance = distance;
+            worst = i;
+        }
+    }
+    flockfile(stderr);
+    fprintf(
+        stderr,
+        "%s(%d): Assertion failed: %s, %zu of %zu elements differ by more than %lu ULP's\n",
+        test_name,
+        line,
+        expr,
+        failed,
+        n,
+        (unsigned long)max_ulps
+    );
+    const int digits = is_double ? 17 : 9;
+    const double x = su_float_array_get(a, is_double, worst);
+    const double y = su_float_array_get(b, is_double, worst);
+    if (worst_distance == UINT64_MAX) {
+        fprintf(stderr, "  never almost equal at index %zu: ", worst);
+    } else {
+        const unsigned long distance = worst_distance;
+        fprintf(stderr, "  max error %lu ULP's at index %zu: ", distance, worst);
+    }
+    fprintf(stderr, "%.*g vs %.*g\n  ULP's", digits, x, digits, y);
+    const char *sep = ": ";
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        if (!histogram[i]) {
+            continue;
+        }
+        fputs(sep, stderr);
+        sep = ", ";
+        if (i + 1 == BUCKET_COUNT) {
+            fprintf(stderr, "never: %zu", histogram[i]);
+        } else if (BUCKETS[i + 1] - BUCKETS[i] == 1) {
+            fprintf(stderr, "%lu: %zu", (unsigned long)BUCKETS[i], histogram[i]);
+        } else if (i + 2 == BUCKET_COUNT) {
+            fprintf(stderr, "%lu+: %zu", (unsigned long)BUCKETS[i], histogram[i]);
+        } else {
+            fprintf(
+                stderr,
+                "%lu-%lu: %zu",
+                (unsigned long)BUCKETS[i],
+                (unsigned long)BUCKETS[i + 1] - 1,
+                histogram[i]
+            );
+        }
+    }
+    fputc('\n', stderr);
+    funlockfile(stderr);
+}
+
+static void
+su_report_far(
+    const void *a,
+    const void *b,
+    bool is_double,
+    size_t n,
+    double abs_err,
+    const char *expr,
+    const char *test_name,
+    int line
+) {
+    size_t failed = 0;
+    size_t worst = 0;
+    double worst_error = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        const double error = su_float_array_error(a, b, is_double, i);
+        if (!(error <= abs_err)) {
+            ++failed;
+        }
+        // NaN errors count as the worst
+        if (!(error <= worst_error) && !isnan(worst_error)) {
+            worst_error = error;
+            worst = i;
+        }
+    }
+    const int digits = is_double ? 17 : 9;
+    fprintf(
+        stderr,
+        "%s(%d): Assertion failed: %s, %zu of %zu elements differ by more than %g\n"
+        "  max error %g at index %zu: %.*g vs %.*g\n",
+        test_name,
+        line,
+        expr,
+        failed,
+        n,
+        abs_err,
+        worst_error,
+        worst,
+        digits,
+        su_float_array_get(a, is_double, worst),
+        digits,
+        su_float_array_get(b, is_double, worst)
+    );
+}
+
+bool
+su_check_float_array_eq(
+    const float *a,
+    const float *b,
+    size_t n,
+    uint64_t max_ulps,
+    const char *expr,
+    const char *test_name,
+    int line
+) {
+    if (su_float_max_ulps(a, b, n) <= max_ulps) {
+        return false;
+    } else if (!su_failure_novel(su_failure_count(line, expr), NULL)) {
+        return true;
+    }
+    su_report_ulps(a, b, false, n, max_ulps, expr, test_name, line);
+    return true;
+}
+
+bool
+su_check_double_array_eq(
+    const double *a,
+    const double *b,
+    size_t n,
+    uint64_t max_ulps,
+    const char *expr,
+    const char *test_name,
+    int line
+) {
+    if (su_double_max_ulps(a, b, n) <= max_ulps) {
+        return false;
+    } else if (!su_failure_novel(su_failure_count(line, expr), NULL)) {
+        return true;
+    }
+    su_report_ulps(a, b, true, n, max_ulps, expr, test_name, line);
+    return true;
+}
+
+bool
+su_check_float_array_near(
+    const float *a,
+    const float *b,
+    size_t n,
+    double abs_err,
+    const char *expr,
+    const char *test_name,
+    int line
+) {
+    if (!su_float_any_far(a, b, n, abs_err)) {
+        return false;
+    } else if (!su_failure_novel(su_failure_count(line, expr), NULL)) {
+        return true;
+    }
+    su_report_far(a, b, false, n, abs_err, expr, test_name, line);
+    return true;
+}
+
+bool
+su_check_double_array_near(
+    const double *a,
+    const double *b,
+    size_t n,
+    double abs_err,
+    const char *expr,
+    const char *test_name,
+    int line
+) {
+    if (!su_double_any_far(a, b, n, abs_err)) {
+        return false;
+    } else if (!su_failure_novel(su_failure_count(line, expr), NULL)) {
+        return true;
+    }
+    su_report_far(a, b, true, n, abs_err, expr, test_name, line);
+    return true;
+}
+
+// MARK: - Memory
+
+// Equal buffers are compared at memory bandwidth, the kernels only find the first differing
+// byte.  Everything else (counting the differing elements, the dump) only happens on failure.
+
+static size_t
+su_mem_mismatch_scalar(const unsigned char *a, const unsigned char *b, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y) {
+            break;
+        }
+    }
+    while (i < n && a[i] == b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+#ifdef __x86_64__
+static size_t
+su_mem_mismatch_sse2(const unsigned char *a, const unsigned char *b, size_t n) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m128i eq = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))
+        );
+        for (size_t j = 16; j < 64; j += 16) {
+            eq = _mm_and_si128(
+                eq,
+                _mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i *)(a + i + j)),
+                    _mm_loadu_si128((const __m128i *)(b + i + j))
+                )
+            );
+        }
+        if (_mm_movemask_epi8(eq) != 0xffff) {
+            break;
+        }
+    }
+    for (; i + 16 <= n; i += 16) {
+        const unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))
+        ));
+        if (mask != 0xffff) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+    return i + su_mem_mismatch_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+su_mem_mismatch_avx2(const unsigned char *a, const unsigned char *b, size_t n) {
+    size_t i = 0;
+    for (; i + 128 <= n; i += 128) {
+        __m256i eq = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(a + i)),
+            _mm256_loadu_si256((const __m256i *)(b + i))
+        );
+        for (size_t j = 32; j < 128; j += 32) {
+            eq = _mm256_and_si256(
+                eq,
+                _mm256_cmpeq_epi8(
+                    _mm256_loadu_si256((const __m256i *)(a + i + j)),
+                    _mm256_loadu_si256((const __m256i *)(b + i + j))
+                )
+            );
+        }
+        if ((unsigned)_mm256_movemask_epi8(eq) != 0xffffffff) {
+            break;
+        }
+    }
+    for (; i + 32 <= n; i += 32) {
+        const unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(a + i)),
+            _mm256_loadu_si256((const __m256i *)(b + i))
+        ));
+        if (mask != 0xffffffff) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+    return i + su_mem_mismatch_sse2(a + i, b + i, n - i);
+}
+#endif
+
+/// Returns the offset of the first byte that differs, or `n` if there is none.
+static size_t
+su_mem_mismatch(const unsigned char *a, const unsigned char *b, size_t n) {
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        return su_mem_mismatch_avx2(a, b, n);
+    }
+    return su_mem_mismatch_sse2(a, b, n);
+#else
+    return su_mem_mismatch_scalar(a, b, n);
+#endif
+}
+
+static void
+su_dump_row(const char *label, const unsigned char *p, size_t start, size_t end) {
+    fputs(label, stderr);
+    for (size_t i = start; i < start + 16; ++i) {
+        if (i < end) {
+            fprintf(stderr, " %02x", p[i]);
+        }
+    }
+    fputc('\n', stderr);
+}
+
+/// Prints the rows of 16 bytes around `offset`, marking the bytes that differ.
+static void
+su_dump_mismatch(const unsigned char *a, const unsigned char *b, size_t size, size_t offset) {
+    const size_t row = offset / 16 * 16;
+    const size_t first = row >= 16 ? row - 16 : 0;
+    const size_t last = size - row > 32 ? row + 32 : size;
+    for (size_t start = first; start < last; start += 16) {
+        char label[32];
+        snprintf(label, sizeof(label), "  %08zx a:", start);
+        su_dump_row(label, a, start, last);
+        su_dump_row("           b:", b, start, last);
+        char marks[16 * 3 + 1] = "";
+        size_t len = 0;
+        for (size_t i = start; i < start + 16 && i < last; ++i) {
+            if (a[i] != b[i]) {
+                const size_t column = (i - start) * 3;
+                memset(marks + len, ' ', column + 1 - len);
+                memcpy(marks + column + 1, "^^", 3);
+                len = column + 3;
+            }
+        }
+        if (len) {
+            fprintf(stderr, "%13s%s\n", "", marks);
+        }
+    }
+}
+
+bool
+su_check_mem_eq(
+    const void *p_a,
+    const void *p_b,
+    size_t size,
+    size_t element_size,
+    const char *expr,
+    const char *test_name,
+    int line
+) {
+    const unsigned char *a = p_a;
+    const unsigned char *b = p_b;
+    const size_t first = su_mem_mismatch(a, b, size);
+    if (first == size) {
+        return false;
+    }
+    su_failure_t *failure = su_failure_count(line, expr);
+    if (failure && failure->full) {
+        return true;
+    }
+    char value[32];
+    snprintf(value, sizeof(value), "%zu", first / element_size);
+    if (!su_failure_novel(failure, value)) {
+        return true;
+    }
+    size_t mismatches = 0;
+    for (size_t offset = first; offset < size;) {
+        ++mismatches;
+        offset = (offset / element_size + 1) * element_size;
+        if (offset < size) {
+            offset += su_mem_mismatch(a + offset, b + offset, size - offset);
+        }
+    }
+    // keep the dump of concurrently failing tests together
+    flockfile(stderr);
+    fprintf(
+        stderr,
+        "%s(%d): Assertion failed: %s, first mismatch at index %zu, %zu of %zu %s differ\n",
+        test_name,
+        line,
+        expr,
+        first / element_size,
+        mismatches,
+        size / element_size,
+        element_size == 1 ? "bytes" : "elements"
+    );
+    su_dump_mismatch(a, b, size, first);
+    funlockfile(stderr);
+    return true;
+}
+
+// MARK: - Latency
+
+// The histogram has a bucket for each value below `2^SU_HISTOGRAM_SUB_BITS`, above that each
+// power of two is split into `2^SU_HISTOGRAM_SUB_BITS` buckets (like HdrHistogram), so every
+// value is known within a relative error of `2^-SU_HISTOGRAM_SUB_BITS`.
+
+#define SU_HISTOGRAM_SUB (1u << SU_HISTOGRAM_SUB_BITS)
+
+void
+su_histogram_record(su_histogram_t *histogram, uint64_t value) {
+    size_t index = value;
+    if (value >= SU_HISTOGRAM_SUB) {
+        const int shift = 63 - __builtin_clzll(value) - SU_HISTOGRAM_SUB_BITS;
+        index = ((size_t)(shift + 1) << SU_HISTOGRAM_SUB_BITS) + (value >> shift)
+              - SU_HISTOGRAM_SUB;
+    }
+    ++histogram->counts[index];
+    if (!histogram->total++ || value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+/// Largest value recorded into the bucket.
+static uint64_t
+su_histogram_upper(size_t index) {
+    if (index < SU_HISTOGRAM_SUB) {
+        return index;
+    }
+    const int shift = (int)(index >> SU_HISTOGRAM_SUB_BITS) - 1;
+    const uint64_t lower = (uint64_t)(SU_HISTOGRAM_SUB + (index & (SU_HISTOGRAM_SUB - 1))) << shift;
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+uint64_t
+su_histogram_percentile(const su_histogram_t *histogram, double percentile) {
+    uint64_t rank = (uint64_t)ceil(percentile / 100.0 * histogram->total);
+    rank = rank ? rank : 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < SU_HISTOGRAM_BUCKETS && histogram->total; ++i) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            const uint64_t upper = su_histogram_upper(i);
+            return upper < histogram->max ? upper : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/// Prints the number of values per power of two and the common percentiles.
+static void
+su_histogram_print(const su_histogram_t *histogram) {
+    static const double PERCENTILES[] = {50.0, 90.0, 99.0, 99.9, 99.99};
+    char value[32];
+    fputs("  ", stderr);
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(*PERCENTILES); ++i) {
+        su_format_ns(value, sizeof(value), su_histogram_percentile(histogram, PERCENTILES[i]));
+        fprintf(stderr, "p%g %s, ", PERCENTILES[i], value);
+    }
+    su_format_ns(value, sizeof(value), histogram->max);
+    fprintf(stderr, "max %s\n", value);
+    uint64_t counts[65] = {0};
+    for (size_t i = 0; i < SU_HISTOGRAM_BUCKETS; ++i) {
+        if (histogram->counts[i]) {
+            const uint64_t upper = su_histogram_upper(i);
+            counts[upper ? 64 - __builtin_clzll(upper) : 0] += histogram->counts[i];
+        }
+    }
+    uint64_t largest = 0;
+    for (int i = 0; i < 65; ++i) {
+        largest = counts[i] > largest ? counts[i] : largest;
+    }
+    // row i holds the values in [2^(i - 1), 2^i)
+    for (int i = 0; i < 65; ++i) {
+        if (!counts[i]) {
+            continue;
+        }
+        char lower[32];
+        su_format_ns(lower, sizeof(lower), i ? (double)((uint64_t)1 << (i - 1)) : 0.0);
+        const int width = (int)(counts[i] * 40 / largest);
+        fprintf(
+            stderr,
+            "  %10s %10lu %6.2f%% %.*s\n",
+            lower,
+            (unsigned long)counts[i],
+            counts[i] * 100.0 / histogram->total,
+            width ? width : 1,
+            "########################################"
+        );
+    }
+}
+
+bool
+su_check_latency(
+    const su_histogram_t *histogram,
+    uint64_t p50,
+    uint64_t p99,
+    uint64_t p999,
+    const char *stmt,
+    const char *test_name,
+    int line
+) {
+    const double percentiles[] = {50.0, 99.0, 99.9};
+    const uint64_t limits[] = {p50, p99, p999};
+    char failed[256] = "";
+    size_t len = 0;
+    for (int i = 0; i < 3; ++i) {
+        const uint64_t value = su_histogram_percentile(histogram, percentiles[i]);
+        if (limits[i] && value > limits[i] && len < sizeof(failed)) {
+            char actual[32], limit[32];
+            su_format_ns(actual, sizeof(actual), value);
+            su_format_ns(limit, sizeof(limit), limits[i]);
+            len += snprintf(
+                failed + len, sizeof(failed) - len, "%sp%g %s > %s", len ? ", " : "",
+                percentiles[i], actual, limit
+            );
+        }
+    }
+    if (!len) {
+        return false;
+    }
+    if (!su_failure_novel(su_failure_count(line, stmt), NULL)) {
+        return true;
+    }
+    flockfile(stderr);
+    fprintf(
+        stderr,
+        "%s(%d): Assertion failed: latency of %s over %lu runs: %s\n",
+        test_name,
+        line,
+        stmt,
+        (unsigned long)histogram->total,
+        failed
+    );
+    su_histogram_print(histogram);
+    funlockfile(stderr);
+    return true;
 }
 
 // MARK: - Global
@@ -770,12 +7136,24 @@ int
 su_run_all_tests() {
     su_result_t result = su_state_run(&su__state);
     su_release_state();
-    return result.counts[SU_FAIL] ? 1 : 0;
+    return result.counts[SU_FAIL] || result.counts[SU_TIMEOUT] ? 1 : 0;
+}
+
+int
+su_run_all_tests_argv(int argc, char **argv) {
+    su_options_default(&su__state.options);
+    su__state.options_initialized = true;
+    if (!su_options_parse(&su__state.options, argc, argv)) {
+        su_release_state();
+        return 2;
+    }
+    return su_run_all_tests();
 }
 
 void
 su_release_state() {
     su_state_drop(&su__state);
+    su_options_drop(&su__state.options);
 }
 
 #endif  // SU_IMPLEMENTATION
@@ -103,6 +103,38 @@ queue_test_tear_down(queue_test *self) {
     queue_drop(&self->q2);
 }
 
+typedef struct {
+    int counter;
+    queue_t q;
+} snapshot_test;
+
+void
+snapshot_test_setup(snapshot_test *self) {
+    self->counter = 1;
+    queue_push(&self->q, 1);
+}
+
+void
+snapshot_test_tear_down(snapshot_test *self) {
+    queue_drop(&self->q);
+}
+
+void
+snapshot_test_clone(snapshot_test *dst, const snapshot_test *src) {
+    dst->counter = src->counter;
+    for (queue_node_t *node = src->q.head; node; node = node->next) {
+        queue_push(&dst->q, *node->item);
+    }
+}
+
+su_fixture_snapshot_clone(snapshot_test);
+
+typedef snapshot_test fork_test;
+#define fork_test_setup snapshot_test_setup
+#define fork_test_tear_down snapshot_test_tear_down
+
+su_fixture_fork(fork_test);
+
 su_test(factorial_test, handles_zero_input) {
     su_expect_eq(factorial(0), 1);
 }
@@ -114,6 +146,31 @@ su_test(factorial_test, handles_positive_input) {
     su_expect_eq(factorial(8), 40320);
 }
 
+su_test(factorial_test, is_fast) {
+    // tens of nanoseconds, the limits leave room for a slow machine and the p99.9 (with
+    // preemptions and page faults) of a shared one is not checked
+    su_expect_latency(su_do_not_optimize(factorial(10)), 10000, 1000, 50000, 0);
+}
+
+su_test(factorial_test, latency_percentiles) {
+    su_histogram_t histogram = {0};
+    for (uint64_t value = 1; value <= 100; ++value) {
+        su_histogram_record(&histogram, value);
+    }
+    su_expect_eq(histogram.total, 100);
+    su_expect_eq(histogram.min, 1);
+    // values below 64 have a bucket each, 98 and 99 share one
+    su_expect_eq(su_histogram_percentile(&histogram, 50), 50);
+    su_expect_eq(su_histogram_percentile(&histogram, 99), 99);
+    su_expect_eq(su_histogram_percentile(&histogram, 100), 100);
+    // 1000 falls into the bucket of 992 to 1007, the reported percentile is its upper end
+    su_histogram_t wide = {0};
+    su_histogram_record(&wide, 1000);
+    su_histogram_record(&wide, 2000000);
+    su_expect_eq(su_histogram_percentile(&wide, 50), 1007);
+    su_expect_eq(su_histogram_percentile(&wide, 99), 2000000);
+}
+
 su_test_f(queue_test, is_empty_initially) {
     su_expect_eq(queue_size(&self->q0), 0);
 }
@@ -137,6 +194,26 @@ su_test_f(queue_test, pop_works) {
     free(n);
 }
 
+su_test_f(snapshot_test, modifies_copy) {
+    su_expect_eq(self->counter++, 1);
+    free(queue_pop(&self->q));
+}
+
+su_test_f(snapshot_test, gets_fresh_copy) {
+    su_expect_eq(self->counter++, 1);
+    su_expect_eq(queue_size(&self->q), 1);
+}
+
+su_test_f(fork_test, modifies_copy) {
+    su_expect_eq(self->counter++, 1);
+    free(queue_pop(&self->q));
+}
+
+su_test_f(fork_test, gets_fresh_copy) {
+    su_expect_eq(self->counter++, 1);
+    su_expect_eq(queue_size(&self->q), 1);
+}
+
 #define MACRO_VALUE false
 
 su_test(mytests, bar) {
@@ -153,6 +230,10 @@ su_test(mytests, qux) {
     su_skip();
 }
 
+su_tagged_test(mytests, tagged, "slow, io") {
+    su_expect_eq(factorial(5), 120);
+}
+
 su_test(mytests, assertions) {
     su_expect_eq(1, 1);
     su_expect_ne(1, 2);
@@ -161,6 +242,46 @@ su_test(mytests, assertions) {
     su_expect_float_eq(1.0f, 1.0f);
     su_expect_double_eq(1.0, 1.0);
     su_expect_near(3.1415926, 22.0 / 7.0, 0.002);
+    const int a[] = {1, 2, 3, 4};
+    const int b[] = {1, 2, 3, 4};
+    su_expect_array_eq(a, b, 4);
+    su_expect_mem_eq("abc", "abd", 2);
+    // 11 floats and 5 doubles cover both the vector loop and the scalar tail
+    float x[11], y[11];
+    for (int i = 0; i < 11; ++i) {
+        x[i] = y[i] = (float)(i + 1) / 3;
+    }
+    for (int i = 0; i < 4; ++i) {
+        y[2] = nextafterf(y[2], INFINITY);
+    }
+    y[9] = nextafterf(nextafterf(y[9], 0), 0);
+    su_expect_float_array_eq(x, y, 11, 4);
+    su_expect_array_near(x, y, 11, 1e-6);
+    su_expect_eq(su_float_distance(su_float_float(x[2]), su_float_float(y[2])), 4);
+    const float beyond = nextafterf(y[2], INFINITY);
+    su_expect_eq(su_float_distance(su_float_float(beyond), su_float_float(x[2])), 5);
+    double u[5], v[5];
+    for (int i = 0; i < 5; ++i) {
+        u[i] = v[i] = (double)(i + 1) / 3;
+    }
+    v[1] = nextafter(nextafter(nextafter(v[1], 0), 0), 0);
+    v[4] = nextafter(v[4], INFINITY);
+    su_expect_double_array_eq(u, v, 5, 3);
+    su_expect_eq(su_float_distance(su_float_double(0.0), su_float_double(-0.0)), UINT64_MAX);
+    su_expect_eq(su_float_distance(su_float_float(NAN), su_float_float(NAN)), UINT64_MAX);
+}
+
+#define check_pair(_a, _b)    \
+    do {                      \
+        su_expect((_a) == 1); \
+        su_expect((_b) == 2); \
+    } while (0)
+
+su_test(mytests, assertions_on_one_line) {
+    // both fail on the same line, the second must not be counted as a repeat of the first
+    su_expect_exit(
+        check_pair(0, 0), su_exited_with_code(0), su_output_contains("Assertion failed: (0) == 2")
+    );
 }
 
 #define do_float(_T, _step, _expected_direct)                               \
@@ -185,6 +306,35 @@ su_test(mytests, float_equality_within_4_ulp) {
     do_float(double, 10000000000000000000000.0, false);
 }
 
+static void
+compare_floats(const float *a, const float *b, size_t n, uint64_t max_ulps) {
+    exit(su_check_float_array_eq(a, b, n, max_ulps, "a == b", "compare_floats", 0));
+}
+
+su_test(mytests, float_arrays_report_ulps) {
+    float x[11], y[11];
+    for (int i = 0; i < 11; ++i) {
+        x[i] = y[i] = (float)(i + 1) / 3;
+    }
+    for (int i = 0; i < 5; ++i) {
+        y[2] = nextafterf(y[2], INFINITY);
+    }
+    su_expect_exit(
+        compare_floats(x, y, 11, 4),
+        su_exited_with_code(1),
+        su_output_contains("1 of 11 elements differ by more than 4 ULP's")
+    );
+    // NaNs and sign changes are never almost equal, in the vector loop and in the tail
+    y[2] = x[2];
+    y[1] = -x[1];
+    y[10] = NAN;
+    su_expect_exit(
+        compare_floats(x, y, 11, 1000),
+        su_exited_with_code(1),
+        su_output_contains("2 of 11 elements differ by more than 1000 ULP's")
+    );
+}
+
 static void
 my_error(void) {
     fputs("error message", stderr);
@@ -202,7 +352,98 @@ su_test(death_tests, death_error) {
     su_expect_death(my_error(), "error message");
 }
 
+static void
+my_verbose_error(void) {
+    // more than fits into a pipe
+    for (int i = 0; i < 10000; ++i) {
+        fprintf(stderr, "line %d of the log\n", i);
+    }
+    puts("done logging");
+    exit(2);
+}
+
+su_test(death_tests, output_matchers) {
+    su_expect_death(my_verbose_error(), su_output_prefix("line 0 "));
+    su_expect_death(my_verbose_error(), su_output_contains("line 5000 of"));
+    su_expect_exit(
+        my_verbose_error(), su_exited_with_code(2), su_output_regex("line 9999 of the log$")
+    );
+    su_expect_death(my_verbose_error(), su_on_stdout(su_output_equals("done logging")));
+}
+
+su_test(death_tests, batched) {
+    su_subproc_batch_t batch = {0};
+    for (int code = 1; code <= 8; ++code) {
+        su_expect_exit_async(&batch, exit(code), su_exited_with_code(code), NULL);
+    }
+    su_expect_death_async(&batch, my_verbose_error(), su_output_contains("line 9999"));
+    su_await_death_tests(&batch);
+}
+
+su_test(timeout_tests, finishes_in_time) {
+    su_expect_eq(usleep(1000), 0);
+}
+
+su_test(timeout_tests, death_test_hangs) {
+    su_expect_death(pause(), NULL);
+}
+
+su_module_timeout(timeout_tests, 1000);
+su_test_timeout(timeout_tests, death_test_hangs, 50);
+
+su_bench(factorial_bench, factorial_10) {
+    su_bench_loop {
+        su_do_not_optimize(factorial(10));
+    }
+}
+
+su_bench_options(factorial_bench, factorial_10, .pin = true, .warmup_ms = 20);
+
+su_bench_range(sum_bench, sum, 16, 65536, 16) {
+    su_expect_complexity(SU_O_N);
+    const size_t n = su_bench_n();
+    int *values = calloc(n, sizeof(*values));
+    su_bench_bytes(n * sizeof(*values));
+    su_bench_loop {
+        int sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += values[i];
+        }
+        su_do_not_optimize(sum);
+        su_clobber_memory();
+    }
+    free(values);
+}
+
+su_bench_f(queue_test, push_pop) {
+    su_bench_items(2);
+    uint64_t allocs = 0;
+    su_bench_loop {
+        queue_push(&self->q0, 1);
+        free(queue_pop(&self->q0));
+        ++allocs;
+    }
+    su_bench_counter("allocs", allocs);
+}
+
+#ifdef SU_TRACK_ALLOCS
+su_test(alloc_tests, budgets) {
+    int buf[16];
+    su_expect_no_alloc(memset(buf, 0, sizeof(buf)));
+    su_expect_max_allocs(free(malloc(64)), 1);
+}
+
+su_test(alloc_tests, page_aligned_balance) {
+    const su_alloc_stats_t before = su_alloc_stats();
+    free(valloc(64));
+    free(pvalloc(64));
+    const su_alloc_stats_t after = su_alloc_stats();
+    su_expect_eq(after.allocs - before.allocs, 2);
+    su_expect_eq(after.live, before.live);
+}
+#endif
+
 int
-main() {
-    return su_run_all_tests();
+main(int argc, char **argv) {
+    return su_run_all_tests_argv(argc, argv);
 }